@@ -1,12 +1,23 @@
 #include "Json.h"
+#include "JsonSchema.h"
+#include "JsonStore.h"
+#include "JsonWriter.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <cerrno>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
+#include <new>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define ASSERT_STEP(pStr, c) \
     do { \
         assert(*pStr == c); \
@@ -16,15 +27,122 @@
 #define ISDIGIT_0TO9(c) ((c) >= '0' && (c) <= '9')
 #define ISDIGIT_1TO9(c) ((c) >= '1' && (c) <= '9')
 #define PUTC(s, c) s.push_back(c)
+
+#ifndef JSON_STACK_INIT_SIZE
+#define JSON_STACK_INIT_SIZE 256
+#endif
+
+// how many nodes are parsed between two looks at the clock, a power of 2
+#ifndef JSON_DEADLINE_INTERVAL
+#define JSON_DEADLINE_INTERVAL 1024
+#endif
+
+#ifndef JSON_SCRATCH_LIMIT
+#define JSON_SCRATCH_LIMIT (1 << 20)
+#endif
+
 namespace JsonParser
 {
 
 Json::Json()
+    : symtab_(nullptr), validate_utf8_(false), pack_numbers_(false),
+      alloc_(nullptr), schema_(nullptr), stack_(nullptr), stack_size_(0), scratch_limit_(JSON_SCRATCH_LIMIT)
 {
 }
 
 Json::~Json()
 {
+    free(stack_);
+}
+
+// a short string fills the bytes that would otherwise hold its pointer
+// and length. the last byte keeps the unused capacity, which doubles as
+// the '\0' terminator of a string using all of it.
+static void store_inline(char *buf, const char *s, size_t len,
+                         size_t capacity = JSON_INLINE_CAPACITY)
+{
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    buf[capacity] = (char)(capacity - len);
+}
+
+// ------------------------------------------------------------ allocation
+
+// blocks from a Json_allocator start with this header, so a tree can be
+// freed without being told where its storage came from
+struct Json_block_header {
+    Json_allocator *alloc;
+    size_t          bytes;
+};
+
+static thread_local Json_allocator *current_allocator = nullptr;
+
+Json_allocator* Json_allocator::current()
+{
+    return current_allocator;
+}
+
+void Json_allocator::set_current(Json_allocator *alloc)
+{
+    current_allocator = alloc;
+}
+
+Json_allocator_stats::Json_allocator_stats()
+    : allocations(0), deallocations(0), bytes_in_use(0), peak_bytes(0)
+{
+}
+
+// storage for a tree, from malloc when alloc is nullptr
+static void* tree_alloc(size_t bytes, Json_allocator *alloc)
+{
+    if (alloc == nullptr) {
+        void *p = malloc(bytes);
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return p;
+    }
+    Json_block_header *h = (Json_block_header*)alloc->allocate(sizeof(Json_block_header) + bytes);
+    h->alloc = alloc;
+    h->bytes = sizeof(Json_block_header) + bytes;
+    return h + 1;
+}
+
+// allocated tells a block of tree_alloc() with an allocator, it is the
+// JSON_ALLOCATED or JSON_KEY_ALLOCATED flag of the owner
+static void tree_free(void *p, bool allocated)
+{
+    if (!allocated) {
+        free(p);
+    } else if (p != nullptr) {
+        Json_block_header *h = (Json_block_header*)p - 1;
+        h->alloc->deallocate(h, h->bytes);
+    }
+}
+
+template <typename T>
+static T* tree_alloc_nodes(size_t count, Json_allocator *alloc)
+{
+    if (count == 0)
+        return nullptr;
+    T *pt = (T*)tree_alloc(count * sizeof(T), alloc);
+    for (size_t i = 0; i < count; ++i)
+        new (&pt[i]) T;
+    return pt;
+}
+
+template <typename T>
+static void tree_free_nodes(T *pt, size_t count, bool allocated)
+{
+    if (pt == nullptr)
+        return;
+    for (size_t i = 0; i < count; ++i)
+        pt[i].~T();
+    tree_free(pt, allocated);
+}
+
+static unsigned char allocated_flag(Json_allocator *alloc)
+{
+    return alloc != nullptr ? JSON_ALLOCATED : 0;
 }
 
 Json_value::Json_value()
@@ -32,34 +150,693 @@ Json_value::Json_value()
     str.pch = nullptr;
     str.len = 0;
     type = Json_type::JSON_NULL;
+    flags = 0;
 }
 
 Json_value::~Json_value()
 {
-    if (type == Json_type::JSON_STRING) {
-        if (str.pch != nullptr) free(str.pch);
+    set_null();
+}
+
+void Json_value::set_null()
+{
+    if (flags & JSON_BORROWED) {
+        // shared with a Json_document, which frees it
+    } else if (type == Json_type::JSON_STRING) {
+        if (!(flags & JSON_INLINE_STRING) && str.pch != nullptr)
+            tree_free(str.pch, flags & JSON_ALLOCATED);
     } else if (type == Json_type::JSON_ARRAY) {
-        delete []arr.elem;
+        if (is_packed())
+            tree_free(narr.num, flags & JSON_ALLOCATED);
+        else
+            tree_free_nodes(arr.elem, arr.size, flags & JSON_ALLOCATED);
     } else if (type == Json_type::JSON_OBJECT) {
-        delete []obj.mem;
+        tree_free_nodes(obj.mem, obj.size, flags & JSON_ALLOCATED);
     }
     type = Json_type::JSON_NULL;
+    flags = 0;
+}
+
+void Json_value::set_boolean(bool b)
+{
+    set_null();
+    type = b ? Json_type::JSON_TRUE : Json_type::JSON_FALSE;
+}
+
+void Json_value::set_number(double n)
+{
+    set_null();
+    number = n;
+    type = Json_type::JSON_NUMBER;
+}
+
+void Json_value::set_string(const char *s, size_t len)
+{
+    if (len <= JSON_INLINE_CAPACITY) {
+        char buf[JSON_INLINE_CAPACITY + 1];
+        store_inline(buf, s, len); // s may point into this value
+        set_null();
+        memcpy(sstr, buf, sizeof(sstr));
+        type = Json_type::JSON_STRING;
+        flags = JSON_INLINE_STRING;
+        return;
+    }
+
+    Json_allocator *alloc = Json_allocator::current();
+    char *pch = (char*)tree_alloc(len + 1, alloc);
+    memcpy(pch, s, len);
+    pch[len] = '\0';
+
+    set_null();
+    str.pch = pch;
+    str.len = len;
+    type = Json_type::JSON_STRING;
+    flags = allocated_flag(alloc);
+}
+
+void Json_value::set_array(size_t size)
+{
+    Json_allocator *alloc = Json_allocator::current();
+    set_null();
+    arr.elem = tree_alloc_nodes<Json_value>(size, alloc);
+    arr.size = size;
+    type = Json_type::JSON_ARRAY;
+    flags = allocated_flag(alloc);
+}
+
+void Json_value::set_packed(const double *num, size_t size)
+{
+    Json_allocator *alloc = Json_allocator::current();
+    double *copy = size > 0 ? (double*)tree_alloc(size * sizeof(double), alloc) : nullptr;
+    if (size > 0)
+        memcpy(copy, num, size * sizeof(double));
+
+    set_null();
+    narr.num = copy;
+    narr.size = size;
+    type = Json_type::JSON_ARRAY;
+    flags = JSON_PACKED_NUMBERS | allocated_flag(alloc);
+}
+
+void Json_value::unpack()
+{
+    if (type != Json_type::JSON_ARRAY || !is_packed())
+        return;
+
+    Json_allocator *alloc = Json_allocator::current();
+    double *num = narr.num;
+    size_t size = narr.size;
+    Json_value *elem = tree_alloc_nodes<Json_value>(size, alloc);
+    for (size_t i = 0; i < size; ++i) {
+        elem[i].number = num[i];
+        elem[i].type = Json_type::JSON_NUMBER;
+    }
+    tree_free(num, flags & JSON_ALLOCATED);
+
+    arr.elem = elem;
+    arr.size = size;
+    flags = allocated_flag(alloc);
+}
+
+void Json_value::set_object(size_t size)
+{
+    Json_allocator *alloc = Json_allocator::current();
+    set_null();
+    obj.mem = tree_alloc_nodes<Json_member>(size, alloc);
+    obj.size = size;
+    type = Json_type::JSON_OBJECT;
+    flags = allocated_flag(alloc);
+}
+
+void Json_value::copy(const Json_value *src)
+{
+    assert(src != this);
+    switch (src->type) {
+        case Json_type::JSON_STRING :
+            set_string(src->get_string(), src->get_string_length());
+            break;
+        case Json_type::JSON_ARRAY :
+            if (src->is_packed()) {
+                set_packed(src->narr.num, src->narr.size);
+                break;
+            }
+            set_array(src->arr.size);
+            for (size_t i = 0; i < arr.size; ++i)
+                arr.elem[i].copy(&src->arr.elem[i]);
+            break;
+        case Json_type::JSON_OBJECT :
+            set_object(src->obj.size);
+            for (size_t i = 0; i < obj.size; ++i) {
+                Json_member &m = obj.mem[i];
+                const Json_member &sm = src->obj.mem[i];
+                m.set_key(sm.get_key(), sm.get_key_length());
+                m.val.copy(&sm.val);
+            }
+            break;
+        default :
+            set_null();
+            memcpy((void*)this, src, sizeof(Json_value)); // nothing owned
+    }
+}
+
+void Json_value::move(Json_value *src)
+{
+    if (src == this)
+        return;
+    set_null();
+    memcpy((void*)this, src, sizeof(Json_value)); // shallow copy
+    src->type = Json_type::JSON_NULL;      // ownership moved
+}
+
+// memmove that tolerates the nullptr storage of empty containers
+static void move_bytes(void *dst, const void *src, size_t n)
+{
+    if (n > 0)
+        memmove(dst, src, n);
+}
+
+// element and member arrays grown by the mutators keep room to grow
+// further: JSON_SPARE_CAPACITY tells the block holds at least
+// spare_capacity(size) nodes, those past size unconstructed
+static size_t spare_capacity(size_t size)
+{
+    size_t capacity = 4;
+    while (capacity < size)
+        capacity *= 2;
+    return capacity;
+}
+
+// makes room for one more node past size, reallocating from the current
+// allocator when the block is full
+template <typename T>
+static T* reserve_node(T *pt, size_t size, unsigned char &flags)
+{
+    if ((flags & JSON_SPARE_CAPACITY) && size < spare_capacity(size))
+        return pt;
+    Json_allocator *alloc = Json_allocator::current();
+    T *grown = (T*)tree_alloc(spare_capacity(size + 1) * sizeof(T), alloc);
+    move_bytes(grown, pt, size * sizeof(T));
+    if (pt != nullptr)
+        tree_free(pt, flags & JSON_ALLOCATED); // nodes moved, not destroyed
+    flags = allocated_flag(alloc) | JSON_SPARE_CAPACITY;
+    return grown;
+}
+
+Json_value* Json_value::insert_element(size_t index)
+{
+    assert(type == Json_type::JSON_ARRAY && index <= arr.size);
+    unpack();
+    arr.elem = reserve_node(arr.elem, arr.size, flags);
+    Json_value *pv = &arr.elem[index];
+    move_bytes(pv + 1, pv, (arr.size - index) * sizeof(Json_value));
+    new (pv) Json_value;
+    arr.size++;
+    return pv;
+}
+
+void Json_value::erase_element(size_t index)
+{
+    assert(type == Json_type::JSON_ARRAY && index < arr.size);
+    unpack();
+    arr.elem[index].set_null();
+    move_bytes(&arr.elem[index], &arr.elem[index + 1],
+               (arr.size - index - 1) * sizeof(Json_value));
+    arr.size--;
+}
+
+Json_value* Json_value::set_member(const char *key, size_t klen)
+{
+    assert(type == Json_type::JSON_OBJECT);
+    Json_value *pv = find(key, klen);
+    if (pv != nullptr)
+        return pv;
+
+    obj.mem = reserve_node(obj.mem, obj.size, flags);
+    Json_member *pm = new (&obj.mem[obj.size]) Json_member;
+    pm->set_key(key, klen);
+    obj.size++;
+    return &pm->val;
+}
+
+bool Json_value::erase_member(const char *key, size_t klen)
+{
+    assert(type == Json_type::JSON_OBJECT);
+    size_t index = 0;
+    while (index < obj.size && !(obj.mem[index].get_key_length() == klen &&
+           memcmp(obj.mem[index].get_key(), key, klen) == 0))
+        index++;
+    if (index == obj.size)
+        return false;
+
+    obj.mem[index].~Json_member();
+    move_bytes(&obj.mem[index], &obj.mem[index + 1],
+               (obj.size - index - 1) * sizeof(Json_member));
+    obj.size--;
+    return true;
+}
+
+Json_value* Json_value::find(const char *key, size_t klen)
+{
+    const Json_value *cthis = this;
+    return const_cast<Json_value*>(cthis->find(key, klen));
+}
+
+const Json_value* Json_value::find(const char *key, size_t klen) const
+{
+    if (type != Json_type::JSON_OBJECT)
+        return nullptr;
+
+    // interned keys share storage, pointer identity settles them
+    for (size_t i = 0; i < obj.size; ++i) {
+        const Json_member &m = obj.mem[i];
+        if ((m.kflags & JSON_KEY_INTERNED) && m.key == key)
+            return &m.val;
+        if (m.get_key_length() == klen && memcmp(m.get_key(), key, klen) == 0)
+            return &m.val;
+    }
+    return nullptr;
+}
+
+// structural hashing, shared by Json_value::hash() and the incremental
+// hash computed by parse(). arrays fold their elements in order, objects
+// add up their member hashes so that member order does not matter.
+static const uint64_t HASH_K1 = 0x9E3779B97F4A7C15ULL;
+static const uint64_t HASH_K2 = 0xC2B2AE3D27D4EB4FULL;
+
+static uint64_t hash_mix(uint64_t h)
+{
+    // splitmix64 finalizer
+    h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static uint64_t hash_bytes(const char *p, size_t len)
+{
+    uint64_t h = hash_mix(len ^ HASH_K2), k;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&k, p, 8);
+        h = (h ^ hash_mix(k)) * HASH_K1;
+    }
+    k = 0;
+    memcpy(&k, p, len);
+    return hash_mix(h ^ hash_mix(k ^ len));
+}
+
+static uint64_t hash_number(double n)
+{
+    uint64_t bits;
+    if (n == 0.0)
+        n = 0.0; // -0 == 0
+    memcpy(&bits, &n, sizeof(bits));
+    return hash_mix(bits ^ (HASH_K1 * Json_type::JSON_NUMBER));
+}
+
+static uint64_t hash_scalar(const Json_value *pv)
+{
+    switch (pv->type) {
+        case Json_type::JSON_NUMBER :
+            return hash_number(pv->number);
+        case Json_type::JSON_STRING :
+            return hash_bytes(pv->get_string(), pv->get_string_length()) ^ HASH_K2;
+        default :
+            return hash_mix(HASH_K1 * (pv->type + 1));
+    }
+}
+
+static uint64_t hash_array_step(uint64_t h, uint64_t elem_hash)
+{
+    return (((h << 5) | (h >> 59)) ^ elem_hash) * HASH_K1;
+}
+
+static uint64_t hash_array_final(uint64_t h, size_t size)
+{
+    return hash_mix(h ^ size ^ (HASH_K2 * Json_type::JSON_ARRAY));
+}
+
+static uint64_t hash_member(uint64_t key_hash, uint64_t val_hash)
+{
+    return hash_mix(key_hash ^ (val_hash * HASH_K1));
+}
+
+static uint64_t hash_object_final(uint64_t sum, size_t size)
+{
+    return hash_mix(sum ^ size ^ (HASH_K2 * Json_type::JSON_OBJECT));
+}
+
+uint64_t Json_value::hash() const
+{
+    uint64_t h = 0;
+
+    switch (type) {
+        case Json_type::JSON_ARRAY :
+            if (is_packed()) {
+                for (size_t i = 0; i < narr.size; ++i)
+                    h = hash_array_step(h, hash_number(narr.num[i]));
+            } else {
+                for (size_t i = 0; i < arr.size; ++i)
+                    h = hash_array_step(h, arr.elem[i].hash());
+            }
+            return hash_array_final(h, arr.size);
+        case Json_type::JSON_OBJECT :
+            for (size_t i = 0; i < obj.size; ++i) {
+                const Json_member &m = obj.mem[i];
+                h += hash_member(hash_bytes(m.get_key(), m.get_key_length()),
+                                 m.val.hash());
+            }
+            return hash_object_final(h, obj.size);
+        default :
+            return hash_scalar(this);
+    }
+}
+
+// equality of two arrays of the same size, at least one of them packed
+static bool packed_equals(const Json_value *a, const Json_value *b)
+{
+    if (!a->is_packed())
+        std::swap(a, b);
+    for (size_t i = 0; i < a->narr.size; ++i) {
+        double n = a->narr.num[i];
+        if (b->is_packed()) {
+            if (b->narr.num[i] != n)
+                return false;
+        } else if (b->arr.elem[i].type != Json_type::JSON_NUMBER ||
+                   b->arr.elem[i].number != n) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool same_key(const Json_member *a, const Json_member *b)
+{
+    size_t klen = a->get_key_length();
+    return klen == b->get_key_length() && memcmp(a->get_key(), b->get_key(), klen) == 0;
+}
+
+static bool same_member(const Json_member *a, const Json_member *b)
+{
+    return same_key(a, b) && a->val.equals(&b->val);
+}
+
+static bool key_less(const Json_member *a, const Json_member *b)
+{
+    size_t alen = a->get_key_length(), blen = b->get_key_length();
+    int cmp = memcmp(a->get_key(), b->get_key(), std::min(alen, blen));
+    return cmp != 0 ? cmp < 0 : alen < blen;
+}
+
+// the members of v from index from on, sorted by key
+static void sort_members(std::vector<const Json_member*> &out, const Json_value *v,
+                         size_t from)
+{
+    out.clear();
+    for (size_t i = from; i < v->obj.size; ++i)
+        out.push_back(&v->obj.mem[i]);
+    std::sort(out.begin(), out.end(), key_less);
+}
+
+// whether the values of count members sharing a key pair off one to
+// one, whatever their order. count is 1 but for repeated keys.
+static bool same_values(const Json_member *const *a, const Json_member *const *b,
+                        size_t count)
+{
+    if (count == 1)
+        return a[0]->val.equals(&b[0]->val);
+    std::vector<bool> used(count);
+    for (size_t i = 0; i < count; ++i) {
+        size_t j = 0;
+        while (j < count && (used[j] || !a[i]->val.equals(&b[j]->val)))
+            j++;
+        if (j == count)
+            return false;
+        used[j] = true;
+    }
+    return true;
+}
+
+bool Json_value::equals(const Json_value *other) const
+{
+    if (type != other->type)
+        return false;
+
+    switch (type) {
+        case Json_type::JSON_NUMBER :
+            return number == other->number;
+        case Json_type::JSON_STRING :
+            return get_string_length() == other->get_string_length() &&
+                   memcmp(get_string(), other->get_string(), get_string_length()) == 0;
+        case Json_type::JSON_ARRAY :
+            if (arr.size != other->arr.size)
+                return false;
+            if (is_packed() || other->is_packed())
+                return packed_equals(this, other);
+            for (size_t i = 0; i < arr.size; ++i) {
+                if (!arr.elem[i].equals(&other->arr.elem[i]))
+                    return false;
+            }
+            return true;
+        case Json_type::JSON_OBJECT : {
+            if (obj.size != other->obj.size)
+                return false;
+            // members usually come in the same order
+            size_t i = 0;
+            while (i < obj.size && same_member(&obj.mem[i], &other->obj.mem[i]))
+                i++;
+            if (i == obj.size)
+                return true;
+
+            // otherwise the rest of both, sorted by key, must hold the
+            // same keys, and each run of a repeated key the same values
+            // (a multiset, as hash() sees it)
+            std::vector<const Json_member*> a, b;
+            sort_members(a, this, i);
+            sort_members(b, other, i);
+            for (size_t k = 0, n = a.size(); k < n; ) {
+                size_t end = k + 1;
+                while (end < n && same_key(a[end], a[k]))
+                    end++;
+                // b holds the run at the same places, no more, no less
+                if (!same_key(a[k], b[k]) || !same_key(a[k], b[end - 1]) ||
+                    (end < n && same_key(b[end], a[k])))
+                    return false;
+                if (!same_values(&a[k], &b[k], end - k))
+                    return false;
+                k = end;
+            }
+            return true;
+        }
+        default :
+            return true;
+    }
 }
 
 Json_member::Json_member()
 {
     key = nullptr;
     klen = 0;
+    kflags = 0;
 }
 
 Json_member::~Json_member()
 {
-    if (key != nullptr) free(key);
+    if (!(kflags & (JSON_KEY_INTERNED | JSON_KEY_INLINE | JSON_KEY_BORROWED)) &&
+        key != nullptr)
+        tree_free(key, kflags & JSON_KEY_ALLOCATED);
+}
+
+void Json_member::set_key(const char *k, size_t len)
+{
+    bool owned = !(kflags & (JSON_KEY_INTERNED | JSON_KEY_INLINE | JSON_KEY_BORROWED));
+    if (len <= JSON_KEY_INLINE_CAPACITY) {
+        char buf[JSON_KEY_INLINE_CAPACITY + 1];
+        store_inline(buf, k, len, JSON_KEY_INLINE_CAPACITY); // k may be this very key
+        if (owned && key != nullptr) tree_free(key, kflags & JSON_KEY_ALLOCATED);
+        memcpy(skey, buf, sizeof(skey));
+        kflags = JSON_KEY_INLINE;
+        return;
+    }
+
+    Json_allocator *alloc = Json_allocator::current();
+    char *copy = (char*)tree_alloc(len + 1, alloc);
+    memcpy(copy, k, len);
+    copy[len] = '\0';
+
+    if (owned && key != nullptr) tree_free(key, kflags & JSON_KEY_ALLOCATED);
+    key = copy;
+    klen = len;
+    kflags = alloc != nullptr ? JSON_KEY_ALLOCATED : 0;
+}
+
+size_t Json_symbol_table::hash(const char *key, size_t klen)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < klen; ++i) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static const size_t SYMTAB_CHUNK_SIZE = 4096;
+
+Json_symbol_table::Json_symbol_table(bool thread_safe)
+    : slots_(64), chunk_cur_(nullptr), chunk_left_(0), count_(0),
+      thread_safe_(thread_safe)
+{
+    for (auto &slot : slots_)
+        slot.key = nullptr;
+}
+
+Json_symbol_table::~Json_symbol_table()
+{
+    for (auto &chunk : chunks_)
+        free(chunk);
+}
+
+Json_symbol_table& Json_symbol_table::global()
+{
+    static Json_symbol_table table(true);
+    return table;
+}
+
+size_t Json_symbol_table::size() const
+{
+    if (thread_safe_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+    return count_;
+}
+
+const char* Json_symbol_table::find_slot(const char *key, size_t klen,
+                                         size_t hash, size_t &pos) const
+{
+    // linear probing, capacity is always a power of two
+    size_t mask = slots_.size() - 1;
+    for (pos = hash & mask; slots_[pos].key != nullptr; pos = (pos + 1) & mask) {
+        const Slot &slot = slots_[pos];
+        if (slot.hash == hash && slot.klen == klen &&
+            memcmp(slot.key, key, klen) == 0)
+            return slot.key;
+    }
+    return nullptr;
+}
+
+char* Json_symbol_table::store(const char *key, size_t klen)
+{
+    size_t need = klen + 1;
+    if (need > chunk_left_) {
+        size_t chunk_size = need > SYMTAB_CHUNK_SIZE ? need : SYMTAB_CHUNK_SIZE;
+        chunk_cur_ = (char*)malloc(chunk_size);
+        chunk_left_ = chunk_size;
+        chunks_.push_back(chunk_cur_);
+    }
+    char *copy = chunk_cur_;
+    memcpy(copy, key, klen);
+    copy[klen] = '\0';
+    chunk_cur_ += need;
+    chunk_left_ -= need;
+    return copy;
+}
+
+void Json_symbol_table::rehash()
+{
+    std::vector<Slot> old(slots_.size() * 2);
+    old.swap(slots_);
+    for (auto &slot : slots_)
+        slot.key = nullptr;
+
+    size_t mask = slots_.size() - 1;
+    for (auto &slot : old) {
+        if (slot.key == nullptr)
+            continue;
+        size_t pos = slot.hash & mask;
+        while (slots_[pos].key != nullptr)
+            pos = (pos + 1) & mask;
+        slots_[pos] = slot;
+    }
+}
+
+const char* Json_symbol_table::insert(const char *key, size_t klen,
+                                      size_t hash, size_t pos)
+{
+    Slot &slot = slots_[pos];
+    slot.key  = store(key, klen);
+    slot.klen = klen;
+    slot.hash = hash;
+    const char *interned = slot.key;
+
+    // keep load factor below 1/2
+    if (++count_ * 2 > slots_.size())
+        rehash();
+    return interned;
+}
+
+const char* Json_symbol_table::intern(const char *key, size_t klen)
+{
+    size_t hash = Json_symbol_table::hash(key, klen);
+    size_t pos;
+
+    if (thread_safe_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const char *found = find_slot(key, klen, hash, pos);
+        return found != nullptr ? found : insert(key, klen, hash, pos);
+    }
+    const char *found = find_slot(key, klen, hash, pos);
+    return found != nullptr ? found : insert(key, klen, hash, pos);
+}
+
+const char* Json_symbol_table::lookup(const char *key, size_t klen) const
+{
+    size_t hash = Json_symbol_table::hash(key, klen);
+    size_t pos;
+
+    if (thread_safe_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return find_slot(key, klen, hash, pos);
+    }
+    return find_slot(key, klen, hash, pos);
+}
+
+void Json::set_symbol_table(Json_symbol_table *symtab)
+{
+    symtab_ = symtab;
 }
 
 struct Json_Context {
     mutable const char *json_str;
     size_t json_len;
+    const char *json_end; // the terminating '\0'
+    Json_symbol_table *symtab;
+    Json_allocator *alloc; // storage of the tree being built
+    bool validate_utf8;
+    bool pack_numbers;
+    std::string *out; // minify output, skip_* only
+    // parse_store output, and the nodes of the containers being parsed
+    Json_store_file *store, *store_stack;
+
+    // Json_limits, SIZE_MAX when unlimited, and what was used so far
+    size_t max_depth, max_nodes, max_string_length, max_bytes;
+    bool has_deadline;
+    std::chrono::steady_clock::time_point deadline;
+    mutable size_t depth, nodes, bytes;
+
+    // schema of the value about to be parsed, nullptr for none, and the
+    // path to a value failing it, built while unwinding
+    mutable const Json_schema_node *node;
+    std::string *schema_path;
+
+    // structural hash of the last value parsed, see Json_value::hash()
+    bool hash_values;
+    mutable uint64_t hash;
+
+    // scratch borrowed from the Json instance for the duration of a call
+    std::string *sbuf;
+    mutable char *stack;
+    mutable size_t size, top;
 };
 
 static void skip_whitespace(const Json_Context* pjc)
@@ -186,32 +963,148 @@ static void encode_utf8(std::string &s, unsigned u)
     }
 }
 
+// budget checks of Json_limits, kept to a compare on the hot path
+static bool count_bytes(const Json_Context *pjc, size_t bytes)
+{
+    pjc->bytes += bytes;
+    return pjc->bytes <= pjc->max_bytes;
+}
+
+static Json_state count_node(const Json_Context *pjc)
+{
+    if (++pjc->nodes > pjc->max_nodes)
+        return Json_state::NODE_LIMIT_EXCEEDED;
+    if (pjc->has_deadline && (pjc->nodes & (JSON_DEADLINE_INTERVAL - 1)) == 0 &&
+        std::chrono::steady_clock::now() > pjc->deadline)
+        return Json_state::DEADLINE_EXCEEDED;
+    return Json_state::OK;
+}
+
 static void set_value_raw_string(char *&raw_str, size_t &len,
-                                 const std::string& s)
+                                 const std::string& s, Json_allocator *alloc)
 {
     len = s.size();
-    raw_str = (char*)malloc(len + 1);
+    raw_str = (char*)tree_alloc(len + 1, alloc);
     memcpy(raw_str, s.c_str(), len);
+    raw_str[len] = '\0';
 }
 
-static Json_state parse_raw_string(char *&raw_str, size_t &len,
-                                   const Json_Context *pjc)
+// nullptr if the stack cannot grow, it is left as it was
+static void* context_push(const Json_Context *pjc, size_t size)
 {
-    ASSERT_STEP(pjc->json_str, '\"');
+    assert(size > 0);
+    if (pjc->top + size >= pjc->size) {
+        size_t new_size = pjc->size == 0 ? JSON_STACK_INIT_SIZE : pjc->size;
+        while (pjc->top + size >= new_size)
+            new_size += new_size >> 1; // grow by 1.5x
+        char *stack = (char*)realloc(pjc->stack, new_size);
+        if (stack == nullptr)
+            return nullptr;
+        pjc->stack = stack;
+        pjc->size = new_size;
+    }
+    void *ret = pjc->stack + pjc->top;
+    pjc->top += size;
+    return ret;
+}
 
-    const char *&p = pjc->json_str;
-    unsigned u, u2;
+static void* context_pop(const Json_Context *pjc, size_t size)
+{
+    assert(pjc->top >= size);
+    return pjc->stack + (pjc->top -= size);
+}
 
-    std::string s;
-    s.reserve(pjc->json_len);
+// pops count parsed T and runs their destructors, used on error paths
+template <typename T>
+static void context_pop_destroy(const Json_Context *pjc, size_t count)
+{
+    T *pt = (T*)context_pop(pjc, count * sizeof(T));
+    for (size_t i = 0; i < count; ++i)
+        pt[i].~T();
+}
 
-    while (true) {
-        char ch = *p++;
-        switch (ch) {
-            case '\"' : // end of qoutation
-                set_value_raw_string(raw_str, len, s);
-                return Json_state::OK;
-            case '\\' : // escape char
+// returns the length of the well formed UTF-8 sequence at p, 0 if
+// it is not (RFC 3629: no overlongs, surrogates or values > U+10FFFF).
+// input is '\0' terminated so a truncated sequence stops the checks.
+static size_t utf8_sequence_length(const unsigned char *p)
+{
+    unsigned char c = p[0], lo = 0x80, hi = 0xBF;
+
+    if (c < 0x80) return 1;
+    if (c < 0xC2) return 0;
+    if (c < 0xE0)
+        return (p[1] & 0xC0) == 0x80 ? 2 : 0;
+    if (c < 0xF0) {
+        if      (c == 0xE0) lo = 0xA0;
+        else if (c == 0xED) hi = 0x9F;
+        return p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80 ? 3 : 0;
+    }
+    if (c < 0xF5) {
+        if      (c == 0xF0) lo = 0x90;
+        else if (c == 0xF4) hi = 0x8F;
+        return p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80 &&
+               (p[3] & 0xC0) == 0x80 ? 4 : 0;
+    }
+    return 0;
+}
+
+// returns how many chars from p can be copied verbatim into a string:
+// anything but '"', '\\', control chars and, when validating UTF-8,
+// non-ASCII bytes. checks 16 bytes at a time where SSE2 is available.
+static size_t scan_plain_chars(const char *p, const char *end, bool ascii_only)
+{
+    const char *start = p;
+
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i ctrl  = _mm_set1_epi8(0x1F);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v)); // v <= 0x1F
+        unsigned mask = _mm_movemask_epi8(special);
+        if (ascii_only)
+            mask |= _mm_movemask_epi8(v); // high bit set
+        if (mask != 0)
+            return p - start + __builtin_ctz(mask);
+        p += 16;
+    }
+#else
+    (void)end;
+#endif
+
+    while (true) {
+        unsigned char ch = (unsigned char)*p;
+        if (ch < 0x20 || ch == '"' || ch == '\\' || (ascii_only && ch >= 0x80))
+            return p - start;
+        p++;
+    }
+}
+
+static Json_state decode_raw_string(std::string &s, const Json_Context *pjc)
+{
+    ASSERT_STEP(pjc->json_str, '\"');
+
+    const char *&p = pjc->json_str;
+    unsigned u, u2;
+
+    s.clear();
+
+    while (true) {
+        size_t run = scan_plain_chars(p, pjc->json_end, pjc->validate_utf8);
+        s.append(p, run);
+        p += run;
+        if (s.size() > pjc->max_string_length)
+            return Json_state::STRING_TOO_LONG;
+
+        char ch = *p++;
+        switch (ch) {
+            case '\"' : // end of qoutation
+                return Json_state::OK;
+            case '\\' : // escape char
                 switch (*p++) {
                     case '\"' : PUTC(s, '\"'); break;
                     case '\\' : PUTC(s, '\\'); break;
@@ -247,39 +1140,88 @@ static Json_state parse_raw_string(char *&raw_str, size_t &len,
                 if ((unsigned char)ch < 0x20) {
                     return Json_state::INVALID_STRING_CHAR;
                 }
+                if (pjc->validate_utf8 && (unsigned char)ch >= 0x80) {
+                    size_t len = utf8_sequence_length((const unsigned char*)p - 1);
+                    if (len == 0)
+                        return Json_state::INVALID_UTF8;
+                    s.append(p - 1, len);
+                    p += len - 1;
+                    break;
+                }
                 PUTC(s, ch);
         }
     }
 }
 
+// heap copy of the string decoded into sbuf
+static Json_state copy_raw_string(char *&raw_str, size_t &len,
+                                  const Json_Context *pjc)
+{
+    const std::string &s = *pjc->sbuf;
+    if (!count_bytes(pjc, s.size() + 1))
+        return Json_state::MEMORY_LIMIT_EXCEEDED;
+    set_value_raw_string(raw_str, len, s, pjc->alloc);
+    return Json_state::OK;
+}
+
+static Json_state parse_key(Json_member *pm, const Json_Context *pjc)
+{
+    std::string &s = *pjc->sbuf;
+    Json_state ret_state = decode_raw_string(s, pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+
+    if (pjc->symtab != nullptr) {
+        pm->key = const_cast<char*>(pjc->symtab->intern(s.data(), s.size()));
+        pm->klen = s.size();
+        pm->kflags |= JSON_KEY_INTERNED;
+    } else if (s.size() <= JSON_KEY_INLINE_CAPACITY) {
+        store_inline(pm->skey, s.data(), s.size(), JSON_KEY_INLINE_CAPACITY);
+        pm->kflags |= JSON_KEY_INLINE;
+    } else {
+        size_t klen;
+        ret_state = copy_raw_string(pm->key, klen, pjc);
+        pm->klen = klen;
+        if (pjc->alloc != nullptr)
+            pm->kflags |= JSON_KEY_ALLOCATED;
+    }
+    return ret_state;
+}
+
 static Json_state parse_string(Json_value *pval, const Json_Context *pjc)
 {
-    char *p = nullptr; size_t len;
-    Json_state ret_state;
+    std::string &s = *pjc->sbuf;
+    Json_state ret_state = decode_raw_string(s, pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
 
-    ret_state = parse_raw_string(p, len, pjc);
-    if (ret_state == Json_state::OK) {
+    if (s.size() <= JSON_INLINE_CAPACITY) {
+        store_inline(pval->sstr, s.data(), s.size());
+        pval->flags = JSON_INLINE_STRING;
+    } else {
+        char *p = nullptr; size_t len;
+        ret_state = copy_raw_string(p, len, pjc);
+        if (ret_state != Json_state::OK)
+            return ret_state;
         pval->str.pch = p;
         pval->str.len = len;
-        pval->type = Json_type::JSON_STRING;
-    } else if (p != nullptr) {
-        free(p);
-        p = nullptr;
+        pval->flags = allocated_flag(pjc->alloc);
     }
-    return ret_state;
+    pval->type = Json_type::JSON_STRING;
+    return Json_state::OK;
 }
 
-static void transfer_value_array(Json_value *pval,
-                                 std::vector<Json_value *>& pv_vec)
+// moves size parsed numbers off the stack into a packed array
+static void transfer_packed_numbers(Json_value *pval, const Json_Context *pjc,
+                                    size_t size)
 {
-    size_t size = pv_vec.size();
-    pval->arr.size = size;
-    pval->arr.elem = new Json_value[size];
-    for (size_t i = 0; i < size; ++i) {
-        memcpy(pval->arr.elem + i, pv_vec[i], sizeof(Json_value)); // shallow copy
-        free(pv_vec[i]); // not delete
-    }
-    pval->type = Json_type::JSON_ARRAY;
+    // allocate before popping, the caller releases the elements if it throws
+    pval->narr.num = size > 0 ? (double*)tree_alloc(size * sizeof(double), pjc->alloc) : nullptr;
+    const Json_value *pv = (const Json_value*)context_pop(pjc, size * sizeof(Json_value));
+    pval->narr.size = size;
+    for (size_t i = 0; i < size; ++i)
+        pval->narr.num[i] = pv[i].number;
+    pval->flags |= JSON_PACKED_NUMBERS | allocated_flag(pjc->alloc);
 }
 
 // forward declaration
@@ -296,114 +1238,916 @@ static Json_state parse_array(Json_value *pval, const Json_Context *pjc)
         pval->type = JSON_ARRAY;
         pval->arr.size = 0;
         pval->arr.elem = NULL;
+        if (pjc->hash_values)
+            pjc->hash = hash_array_final(0, 0);
         return Json_state::OK;
     } 
 
     Json_state ret_state;
-    std::vector<Json_value*> pv_vec;
+    size_t size = 0;
+    uint64_t h = 0;
+    bool all_numbers = true;
+    const Json_schema_node *item = Json_schema::item(pjc->node);
 
-    auto del_pv = [](const std::vector<Json_value*>& pvec) {
-        for (auto & e : pvec)
-            delete e;
-    };
+    // the allocator may throw, values pushed so far are released then
+    try {
+        while (true) { 
+            // parse into a local, then move it onto the context stack
+            Json_value v_tmp;
+            pjc->node = item;
+            ret_state = parse_value(&v_tmp, pjc);
+            if (ret_state != Json_state::OK) {
+                if (ret_state == Json_state::SCHEMA_MISMATCH) {
+                    std::string index = std::to_string(size);
+                    Json_schema::prepend_token(*pjc->schema_path, index.data(), index.size());
+                }
+                context_pop_destroy<Json_value>(pjc, size);
+                return ret_state;
+            }
+            // arrays that will be packed are charged the doubles they keep,
+            // the first other value makes up for the elements before it
+            size_t bytes = sizeof(Json_value);
+            if (pjc->pack_numbers && all_numbers)
+                bytes = v_tmp.type == Json_type::JSON_NUMBER ? sizeof(double) :
+                        bytes + size * (sizeof(Json_value) - sizeof(double));
+            if (!count_bytes(pjc, bytes)) {
+                context_pop_destroy<Json_value>(pjc, size);
+                return Json_state::MEMORY_LIMIT_EXCEEDED;
+            }
+            void *slot = context_push(pjc, sizeof(Json_value));
+            if (slot == nullptr) {
+                context_pop_destroy<Json_value>(pjc, size);
+                return Json_state::OUT_OF_MEMORY;
+            }
+            memcpy(slot, &v_tmp, sizeof(Json_value));
+            all_numbers = all_numbers && v_tmp.type == Json_type::JSON_NUMBER;
+            v_tmp.type = Json_type::JSON_NULL; // ownership moved
+            size++;
+            if (pjc->hash_values)
+                h = hash_array_step(h, pjc->hash);
 
-    while (true) { 
-        // Json_value *pv_tmp = (Json_value*)malloc(sizeof(Json_value)); 
-        Json_value *pv_tmp = new Json_value;
-        pv_vec.push_back(pv_tmp);
+            // parse end of array
+            skip_whitespace(pjc);
+            if (*pjc->json_str == ',') {
+                pjc->json_str++;
+                skip_whitespace(pjc);
+            } else if (*pjc->json_str == ']') {
+                pjc->json_str++;
+                if (all_numbers && pjc->pack_numbers) {
+                    transfer_packed_numbers(pval, pjc, size);
+                } else {
+                    pval->arr.size = size;
+                    pval->arr.elem = (Json_value*)tree_alloc(size * sizeof(Json_value), pjc->alloc);
+                    memcpy((void*)pval->arr.elem, context_pop(pjc, size * sizeof(Json_value)),
+                           size * sizeof(Json_value)); // shallow copy
+                    pval->flags |= allocated_flag(pjc->alloc);
+                }
+                pval->type = Json_type::JSON_ARRAY;
+                if (pjc->hash_values)
+                    pjc->hash = hash_array_final(h, size);
+                return Json_state::OK;
+            } else {
+                context_pop_destroy<Json_value>(pjc, size);
+                return Json_state::MISS_COMMA_OR_SQUARE_BRACKET;
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        context_pop_destroy<Json_value>(pjc, size);
+        return Json_state::OUT_OF_MEMORY;
+    }
 
-        // parse value
-        ret_state = parse_value(pv_tmp, pjc);
-        if (ret_state != Json_state::OK) {
-            del_pv(pv_vec);
+}
+
+static Json_state parse_object(Json_value *pval, const Json_Context *pjc)
+{
+    ASSERT_STEP(pjc->json_str, '{');
+
+    skip_whitespace(pjc);
+
+    if (*pjc->json_str == '}') {
+        pjc->json_str++;
+        pval->type = JSON_OBJECT;
+        pval->obj.mem = nullptr;
+        pval->obj.size = 0;
+        if (pjc->hash_values)
+            pjc->hash = hash_object_final(0, 0);
+        return Json_state::OK;
+    }
+
+    Json_state ret_state;
+    size_t size = 0;
+    uint64_t h = 0, key_hash = 0;
+    const Json_schema_node *node = pjc->node;
+
+    // the allocator may throw, values pushed so far are released then
+    try {
+        while (true) {
+            Json_member m_tmp;
+
+            // parse key
+            if (*pjc->json_str != '"') {
+                context_pop_destroy<Json_member>(pjc, size);
+                return Json_state::MISS_KEY;
+            }
+            ret_state = parse_key(&m_tmp, pjc);
+            if (ret_state != Json_state::OK) {
+                context_pop_destroy<Json_member>(pjc, size);
+                return ret_state;
+            }
+            if (pjc->hash_values)
+                key_hash = hash_bytes(m_tmp.get_key(), m_tmp.get_key_length());
+
+            // parse comma
+            skip_whitespace(pjc);
+            if (*pjc->json_str != ':') {
+                context_pop_destroy<Json_member>(pjc, size);
+                return Json_state::MISS_COLON;
+            }
+            pjc->json_str++;
+
+            // parse value
+            skip_whitespace(pjc);
+            if (node != nullptr)
+                pjc->node = Json_schema::property(node, m_tmp.get_key(), m_tmp.get_key_length());
+            ret_state = parse_value(&m_tmp.val, pjc);
+            if (ret_state != Json_state::OK) {
+                if (ret_state == Json_state::SCHEMA_MISMATCH)
+                    Json_schema::prepend_token(*pjc->schema_path, m_tmp.get_key(),
+                                               m_tmp.get_key_length());
+                context_pop_destroy<Json_member>(pjc, size);
+                return ret_state;
+            }
+            if (!count_bytes(pjc, sizeof(Json_member))) {
+                context_pop_destroy<Json_member>(pjc, size);
+                return Json_state::MEMORY_LIMIT_EXCEEDED;
+            }
+            void *slot = context_push(pjc, sizeof(Json_member));
+            if (slot == nullptr) {
+                context_pop_destroy<Json_member>(pjc, size);
+                return Json_state::OUT_OF_MEMORY;
+            }
+            memcpy(slot, &m_tmp, sizeof(Json_member));
+            m_tmp.key = nullptr; // ownership moved
+            m_tmp.val.type = Json_type::JSON_NULL;
+            size++;
+            if (pjc->hash_values)
+                h += hash_member(key_hash, pjc->hash);
+
+            // parse end of member
+            skip_whitespace(pjc);
+            if (*pjc->json_str == ',') {
+                pjc->json_str++;
+                skip_whitespace(pjc);
+            } else if (*pjc->json_str == '}') {
+                pjc->json_str++;
+                pval->obj.size = size;
+                pval->obj.mem = (Json_member*)tree_alloc(size * sizeof(Json_member), pjc->alloc);
+                memcpy((void*)pval->obj.mem, context_pop(pjc, size * sizeof(Json_member)),
+                       size * sizeof(Json_member)); // shallow copy
+                pval->flags |= allocated_flag(pjc->alloc);
+                pval->type = Json_type::JSON_OBJECT;
+                if (pjc->hash_values)
+                    pjc->hash = hash_object_final(h, size);
+                return Json_state::OK;
+            } else {
+                context_pop_destroy<Json_member>(pjc, size);
+                return Json_state::MISS_COMMA_OR_CURLY_BRACKET;
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        context_pop_destroy<Json_member>(pjc, size);
+        return Json_state::OUT_OF_MEMORY;
+    }
+}
+
+// the keywords of the value's own schema, its members and elements were
+// checked as they were parsed
+static Json_state check_schema(Json_value *pval, const Json_schema_node *node,
+                               Json_state ret_state)
+{
+    if (ret_state == Json_state::OK && node != nullptr && !Json_schema::check(node, pval)) {
+        pval->set_null();
+        return Json_state::SCHEMA_MISMATCH;
+    }
+    return ret_state;
+}
+
+static Json_state parse_value(Json_value *pval, const Json_Context *pjc)
+{
+    Json_state ret_state = count_node(pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+
+    const Json_schema_node *node = pjc->node;
+    switch (*pjc->json_str) {
+        case 'n' :  ret_state = parse_null(pval, pjc);   break;
+        case 'f' :  ret_state = parse_false(pval, pjc);  break;
+        case 't' :  ret_state = parse_true(pval, pjc);   break;
+        case '\"' : ret_state = parse_string(pval, pjc); break;
+        case '[' :
+            if (pjc->depth == pjc->max_depth)
+                return Json_state::DEPTH_LIMIT_EXCEEDED;
+            if (node != nullptr && !Json_schema::accepts_type(node, Json_type::JSON_ARRAY))
+                return Json_state::SCHEMA_MISMATCH;
+            pjc->depth++;
+            ret_state = parse_array(pval, pjc);
+            pjc->depth--;
+            return check_schema(pval, node, ret_state);
+        case '{' :
+            if (pjc->depth == pjc->max_depth)
+                return Json_state::DEPTH_LIMIT_EXCEEDED;
+            if (node != nullptr && !Json_schema::accepts_type(node, Json_type::JSON_OBJECT))
+                return Json_state::SCHEMA_MISMATCH;
+            pjc->depth++;
+            ret_state = parse_object(pval, pjc);
+            pjc->depth--;
+            return check_schema(pval, node, ret_state);
+        case '\0' : return Json_state::EXPECT_VALUE;
+        // default :   return Json_state::INVALID_VALUE;
+        default :   ret_state = parse_number(pval, pjc); break;
+    }
+    if (pjc->hash_values && ret_state == Json_state::OK)
+        pjc->hash = hash_scalar(pval);
+    return check_schema(pval, node, ret_state);
+}
+
+// DOM-less counterparts of the parse_* functions: they check the same
+// grammar and, when pjc->out is set, copy each token there without the
+// surrounding whitespace. strings are still decoded, but into the
+// reused scratch buffer, so the escape and UTF-8 checks are shared.
+static Json_state skip_value(const Json_Context *pjc);
+
+static void skip_put(const Json_Context *pjc, char ch)
+{
+    if (pjc->out != nullptr)
+        PUTC((*pjc->out), ch);
+}
+
+static Json_state skip_string(const Json_Context *pjc)
+{
+    const char *start = pjc->json_str;
+    Json_state ret_state = decode_raw_string(*pjc->sbuf, pjc);
+    if (ret_state == Json_state::OK && pjc->out != nullptr)
+        pjc->out->append(start, pjc->json_str - start);
+    return ret_state;
+}
+
+static Json_state skip_scalar(const Json_Context *pjc)
+{
+    const char *start = pjc->json_str;
+    Json_value v_tmp;
+    Json_state ret_state;
+
+    switch (*start) {
+        case 'n' :  ret_state = parse_null(&v_tmp, pjc);   break;
+        case 'f' :  ret_state = parse_false(&v_tmp, pjc);  break;
+        case 't' :  ret_state = parse_true(&v_tmp, pjc);   break;
+        default :   ret_state = parse_number(&v_tmp, pjc); break;
+    }
+    if (ret_state == Json_state::OK && pjc->out != nullptr)
+        pjc->out->append(start, pjc->json_str - start);
+    return ret_state;
+}
+
+static Json_state skip_array(const Json_Context *pjc)
+{
+    ASSERT_STEP(pjc->json_str, '[');
+    skip_put(pjc, '[');
+
+    skip_whitespace(pjc);
+
+    if (*pjc->json_str == ']') {
+        pjc->json_str++;
+        skip_put(pjc, ']');
+        return Json_state::OK;
+    }
+
+    Json_state ret_state;
+
+    while (true) {
+        ret_state = skip_value(pjc);
+        if (ret_state != Json_state::OK)
             return ret_state;
-        } 
 
-        // parse end of array
         skip_whitespace(pjc);
         if (*pjc->json_str == ',') {
             pjc->json_str++;
+            skip_put(pjc, ',');
             skip_whitespace(pjc);
         } else if (*pjc->json_str == ']') {
             pjc->json_str++;
-            transfer_value_array(pval, pv_vec);
+            skip_put(pjc, ']');
             return Json_state::OK;
         } else {
-            del_pv(pv_vec);
             return Json_state::MISS_COMMA_OR_SQUARE_BRACKET;
         }
     }
+}
+
+static Json_state skip_object(const Json_Context *pjc)
+{
+    ASSERT_STEP(pjc->json_str, '{');
+    skip_put(pjc, '{');
+
+    skip_whitespace(pjc);
+
+    if (*pjc->json_str == '}') {
+        pjc->json_str++;
+        skip_put(pjc, '}');
+        return Json_state::OK;
+    }
+
+    Json_state ret_state;
+
+    while (true) {
+        // parse key
+        if (*pjc->json_str != '"')
+            return Json_state::MISS_KEY;
+        ret_state = skip_string(pjc);
+        if (ret_state != Json_state::OK)
+            return ret_state;
 
+        // parse comma
+        skip_whitespace(pjc);
+        if (*pjc->json_str != ':')
+            return Json_state::MISS_COLON;
+        pjc->json_str++;
+        skip_put(pjc, ':');
+
+        // parse value
+        skip_whitespace(pjc);
+        ret_state = skip_value(pjc);
+        if (ret_state != Json_state::OK)
+            return ret_state;
+
+        // parse end of member
+        skip_whitespace(pjc);
+        if (*pjc->json_str == ',') {
+            pjc->json_str++;
+            skip_put(pjc, ',');
+            skip_whitespace(pjc);
+        } else if (*pjc->json_str == '}') {
+            pjc->json_str++;
+            skip_put(pjc, '}');
+            return Json_state::OK;
+        } else {
+            return Json_state::MISS_COMMA_OR_CURLY_BRACKET;
+        }
+    }
 }
 
-static void transfer_value_object(Json_value *pval,
-                                        std::vector<Json_member *> pjm)
+static Json_state skip_value(const Json_Context *pjc)
 {
-    size_t size = pjm.size();
-    pval->obj.size = size;
-    pval->obj.mem = new Json_member[size];
-    for (size_t i = 0; i < size; ++i) {
-        memcpy(pval->obj.mem + i, pjm[i], sizeof(Json_member)); // shallow copy
-        free(pjm[i]); // not delete
-        pjm[i] = nullptr;
+    Json_state ret_state = count_node(pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+
+    switch (*pjc->json_str) {
+        case '\"' : return skip_string(pjc);
+        case '[' :
+        case '{' :
+            if (pjc->depth == pjc->max_depth)
+                return Json_state::DEPTH_LIMIT_EXCEEDED;
+            pjc->depth++;
+            ret_state = *pjc->json_str == '[' ? skip_array(pjc) : skip_object(pjc);
+            pjc->depth--;
+            return ret_state;
+        case '\0' : return Json_state::EXPECT_VALUE;
+        default :   return skip_scalar(pjc);
     }
-    pval->type = Json_type::JSON_OBJECT;
+}
 
+void Json::init_context(Json_Context *pjc, const std::string &json_str)
+{
+    init_context(pjc, json_str.c_str(), json_str.size());
 }
 
-static Json_state parse_object(Json_value *pval, const Json_Context *pjc)
+void Json::init_context(Json_Context *pjc, const char *json, size_t len)
 {
-    ASSERT_STEP(pjc->json_str, '{');
+    pjc->json_str = json;
+    pjc->json_len = len + 1;
+    assert(json[len] == '\0');
+    pjc->json_end = json + len;
+    pjc->validate_utf8 = validate_utf8_;
+    pjc->pack_numbers = pack_numbers_;
+    pjc->out = nullptr;
+    pjc->store = pjc->store_stack = nullptr;
+    pjc->hash_values = false;
+    pjc->hash = 0;
 
-    skip_whitespace(pjc);
+    const size_t unlimited = (size_t)-1;
+    pjc->max_depth  = limits_.max_depth > 0 ? limits_.max_depth : unlimited;
+    pjc->max_nodes  = limits_.max_nodes > 0 ? limits_.max_nodes : unlimited;
+    pjc->max_string_length = limits_.max_string_length > 0 ?
+                             limits_.max_string_length : unlimited;
+    pjc->max_bytes  = limits_.max_total_bytes > 0 ? limits_.max_total_bytes : unlimited;
+    pjc->has_deadline = limits_.timeout_us > 0;
+    if (pjc->has_deadline)
+        pjc->deadline = std::chrono::steady_clock::now() +
+                        std::chrono::microseconds(limits_.timeout_us);
+    pjc->depth = pjc->nodes = pjc->bytes = 0;
+
+    pjc->node = nullptr;
+    pjc->schema_path = &schema_path_;
+
+    pjc->symtab = symtab_;
+    pjc->alloc  = alloc_;
+    pjc->sbuf   = &sbuf_;
+    pjc->stack  = stack_;
+    pjc->size   = stack_size_;
+    pjc->top    = 0;
+}
+
+void Json::release_context(Json_Context *pjc)
+{
+    assert(pjc->top == 0);
+    stack_      = pjc->stack;
+    stack_size_ = pjc->size;
+
+    // drop scratch that grew past the high-water limit
+    if (stack_size_ > scratch_limit_) {
+        free(stack_);
+        stack_ = nullptr;
+        stack_size_ = 0;
+    }
+    if (sbuf_.capacity() > scratch_limit_)
+        std::string().swap(sbuf_);
+}
+
+Json_state Json::parse(Json_value *pval, const std::string& json_str,
+                        uint64_t *hash)
+{
+    return parse(pval, json_str.c_str(), json_str.size(), hash);
+}
+
+Json_state Json::parse(Json_value *pval, const char *json, size_t len,
+                        uint64_t *hash)
+{
+    Json_Context jc;
+    Json_state   state;
+
+    init_context(&jc, json, len);
+    jc.hash_values = hash != nullptr;
+    jc.node = schema_ != nullptr ? schema_->root() : nullptr;
+    schema_path_.clear();
+
+    try {
+        skip_whitespace(&jc);
+        state = parse_value(pval, &jc);
+    } catch (const std::bad_alloc&) {
+        // arrays and objects released what they held on the stack
+        state = Json_state::OUT_OF_MEMORY;
+    }
+
+    if (state == Json_state::OK) {
+        skip_whitespace(&jc);
+        if (*jc.json_str != '\0')
+            state = Json_state::ROOT_NOT_SINGULAR;
+    }
+    if (state == Json_state::OK && hash != nullptr)
+        *hash = jc.hash;
+    
+    release_context(&jc);
+    return state;
+}
+
+Json_state Json::scan(const std::string& json_str, std::string *out)
+{
+    Json_Context jc;
+    Json_state   state;
+
+    init_context(&jc, json_str);
+    jc.out = out;
+
+    try {
+        skip_whitespace(&jc);
+        state = skip_value(&jc);
+    } catch (const std::bad_alloc&) {
+        state = Json_state::OUT_OF_MEMORY;
+    }
+
+    if (state == Json_state::OK) {
+        skip_whitespace(&jc);
+        if (*jc.json_str != '\0')
+            state = Json_state::ROOT_NOT_SINGULAR;
+    }
+
+    release_context(&jc);
+    return state;
+}
+
+// ------------------------------------------------------------ columns
+
+Json_column::Json_column(const std::string &name, Json_column_type type)
+    : name(name), type(type), size(0), null_count(0)
+{
+    offsets.push_back(0);
+}
+
+void Json_column::clear()
+{
+    size = null_count = 0;
+    valid.clear();
+    f64.clear();
+    i64.clear();
+    offsets.assign(1, 0);
+    bytes.clear();
+}
+
+static void column_add_row(Json_column &col, bool is_valid)
+{
+    if ((col.size & 7) == 0)
+        col.valid.push_back(0);
+    if (is_valid)
+        col.valid.back() |= (uint8_t)(1 << (col.size & 7));
+    else
+        col.null_count++;
+    col.size++;
+}
+
+static void column_add_null(Json_column &col)
+{
+    column_add_row(col, false);
+    switch (col.type) {
+        case JSON_COLUMN_DOUBLE : col.f64.push_back(0.0); break;
+        case JSON_COLUMN_INT64 :  col.i64.push_back(0);   break;
+        case JSON_COLUMN_STRING : col.offsets.push_back(col.bytes.size()); break;
+    }
+}
 
+// the integer spelled by the number parsed from start, integers beyond
+// 2^53 are read from the text rather than through a double
+static bool number_to_int64(const char *start, const char *end, double n,
+                            int64_t &i)
+{
+    if (std::find_if(start, end, [](char ch) {
+            return ch == '.' || ch == 'e' || ch == 'E'; }) == end) {
+        errno = 0;
+        long long ll = std::strtoll(start, nullptr, 10);
+        if (errno == ERANGE)
+            return false;
+        i = (int64_t)ll;
+        return true;
+    }
+    // -2^63 <= n < 2^63
+    if (n != std::floor(n) || n < -9223372036854775808.0 || n >= 9223372036854775808.0)
+        return false;
+    i = (int64_t)n;
+    return true;
+}
+
+// the value at json_str is not of the type wanted: COLUMN_MISMATCH if
+// it is well formed, its parse error otherwise
+static Json_state column_mismatch(const Json_Context *pjc)
+{
+    pjc->nodes--; // counted by the caller already
+    Json_state ret_state = skip_value(pjc);
+    return ret_state == Json_state::OK ? Json_state::COLUMN_MISMATCH : ret_state;
+}
+
+static Json_state parse_column_value(Json_column &col, const Json_Context *pjc)
+{
+    Json_state ret_state = count_node(pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+
+    const char *start = pjc->json_str;
+    Json_value v_tmp;
+    if (*start == 'n') {
+        ret_state = parse_null(&v_tmp, pjc);
+        if (ret_state == Json_state::OK)
+            column_add_null(col);
+        return ret_state;
+    }
+
+    switch (col.type) {
+        case JSON_COLUMN_STRING : {
+            if (*start != '"')
+                return column_mismatch(pjc);
+            const std::string &s = *pjc->sbuf;
+            ret_state = decode_raw_string(*pjc->sbuf, pjc);
+            if (ret_state != Json_state::OK)
+                return ret_state;
+            if (!count_bytes(pjc, s.size() + sizeof(uint64_t)))
+                return Json_state::MEMORY_LIMIT_EXCEEDED;
+            col.bytes.append(s);
+            col.offsets.push_back(col.bytes.size());
+            break;
+        }
+        default : {
+            if (*start != '-' && !ISDIGIT_0TO9(*start))
+                return column_mismatch(pjc);
+            ret_state = parse_number(&v_tmp, pjc);
+            if (ret_state != Json_state::OK)
+                return ret_state;
+            if (!count_bytes(pjc, sizeof(double)))
+                return Json_state::MEMORY_LIMIT_EXCEEDED;
+            if (col.type == JSON_COLUMN_DOUBLE) {
+                col.f64.push_back(v_tmp.number);
+            } else {
+                int64_t i;
+                if (!number_to_int64(start, pjc->json_str, v_tmp.number, i))
+                    return Json_state::COLUMN_MISMATCH;
+                col.i64.push_back(i);
+            }
+        }
+    }
+    column_add_row(col, true);
+    return Json_state::OK;
+}
+
+// the column named key, trying first the one that followed the previous
+// key in the last row since records tend to share their member order
+static Json_column* find_column(std::vector<Json_column> &columns,
+                                std::vector<size_t> &order, size_t pos,
+                                const std::string &key)
+{
+    if (pos < order.size() && order[pos] < columns.size() &&
+        columns[order[pos]].name == key)
+        return &columns[order[pos]];
+    for (size_t c = 0; c < columns.size(); ++c) {
+        if (columns[c].name == key) {
+            if (pos >= order.size())
+                order.resize(pos + 1);
+            order[pos] = c;
+            return &columns[c];
+        }
+    }
+    return nullptr;
+}
+
+// one object of the array, adding a row to every column
+static Json_state parse_column_row(std::vector<Json_column> &columns,
+                                   std::vector<size_t> &order,
+                                   std::vector<char> &seen,
+                                   const Json_Context *pjc)
+{
+    Json_state ret_state = count_node(pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+    if (*pjc->json_str != '{')
+        return column_mismatch(pjc);
+    if (pjc->depth == pjc->max_depth)
+        return Json_state::DEPTH_LIMIT_EXCEEDED;
+    pjc->json_str++;
+    pjc->depth++;
+
+    std::fill(seen.begin(), seen.end(), 0);
+    skip_whitespace(pjc);
     if (*pjc->json_str == '}') {
         pjc->json_str++;
-        pval->type = JSON_OBJECT;
-        pval->obj.mem = nullptr;
-        pval->obj.size = 0;
+    } else {
+        for (size_t pos = 0; ; ++pos) {
+            // parse key
+            if (*pjc->json_str != '"')
+                return Json_state::MISS_KEY;
+            ret_state = decode_raw_string(*pjc->sbuf, pjc);
+            if (ret_state != Json_state::OK)
+                return ret_state;
+            Json_column *col = find_column(columns, order, pos, *pjc->sbuf);
+
+            // parse comma
+            skip_whitespace(pjc);
+            if (*pjc->json_str != ':')
+                return Json_state::MISS_COLON;
+            pjc->json_str++;
+
+            // parse value
+            skip_whitespace(pjc);
+            if (col != nullptr && !seen[col - &columns[0]]) {
+                seen[col - &columns[0]] = 1;
+                ret_state = parse_column_value(*col, pjc);
+            } else {
+                ret_state = skip_value(pjc);
+            }
+            if (ret_state != Json_state::OK)
+                return ret_state;
+
+            // parse end of member
+            skip_whitespace(pjc);
+            if (*pjc->json_str == ',') {
+                pjc->json_str++;
+                skip_whitespace(pjc);
+            } else if (*pjc->json_str == '}') {
+                pjc->json_str++;
+                break;
+            } else {
+                return Json_state::MISS_COMMA_OR_CURLY_BRACKET;
+            }
+        }
+    }
+    pjc->depth--;
+
+    for (size_t c = 0; c < columns.size(); ++c) {
+        if (!seen[c])
+            column_add_null(columns[c]);
+    }
+    return Json_state::OK;
+}
+
+static Json_state parse_column_rows(std::vector<Json_column> &columns,
+                                    const Json_Context *pjc)
+{
+    Json_state ret_state = count_node(pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+    if (*pjc->json_str != '[')
+        return column_mismatch(pjc);
+    if (pjc->depth == pjc->max_depth)
+        return Json_state::DEPTH_LIMIT_EXCEEDED;
+    pjc->json_str++;
+    pjc->depth++;
+
+    skip_whitespace(pjc);
+    if (*pjc->json_str == ']') {
+        pjc->json_str++;
         return Json_state::OK;
     }
 
+    std::vector<size_t> order;
+    std::vector<char> seen(columns.size());
+    while (true) {
+        ret_state = parse_column_row(columns, order, seen, pjc);
+        if (ret_state != Json_state::OK)
+            return ret_state;
+
+        skip_whitespace(pjc);
+        if (*pjc->json_str == ',') {
+            pjc->json_str++;
+            skip_whitespace(pjc);
+        } else if (*pjc->json_str == ']') {
+            pjc->json_str++;
+            pjc->depth--;
+            return Json_state::OK;
+        } else {
+            return Json_state::MISS_COMMA_OR_SQUARE_BRACKET;
+        }
+    }
+}
+
+Json_state Json::parse_columns(const std::string& json_str,
+                               std::vector<Json_column>& columns)
+{
+    Json_Context jc;
+    Json_state   state;
+
+    for (Json_column &col : columns)
+        col.clear();
+
+    init_context(&jc, json_str);
+
+    try {
+        skip_whitespace(&jc);
+        state = parse_column_rows(columns, &jc);
+    } catch (const std::bad_alloc&) {
+        state = Json_state::OUT_OF_MEMORY;
+    }
+
+    if (state == Json_state::OK) {
+        skip_whitespace(&jc);
+        if (*jc.json_str != '\0')
+            state = Json_state::ROOT_NOT_SINGULAR;
+    }
+
+    release_context(&jc);
+    return state;
+}
+
+// ------------------------------------------------------------ store
+
+static Json_state store_value(Json_store_node *node, const Json_Context *pjc);
+
+static void set_store_node(Json_store_node *node, Json_type type,
+                           uint64_t data, uint64_t size)
+{
+    node->data = data;
+    node->info = (size << 3) | type;
+}
+
+static Json_state store_string(Json_store_node *node, const Json_Context *pjc)
+{
+    const std::string &s = *pjc->sbuf;
+    Json_state ret_state = decode_raw_string(*pjc->sbuf, pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+
+    uint64_t offset;
+    if (!count_bytes(pjc, s.size() + 1))
+        return Json_state::MEMORY_LIMIT_EXCEEDED;
+    if (!pjc->store->append(s.size() + 1, offset))
+        return Json_state::IO_ERROR;
+    memcpy(pjc->store->at(offset), s.c_str(), s.size() + 1);
+    set_store_node(node, Json_type::JSON_STRING, offset, s.size());
+    return Json_state::OK;
+}
+
+// a finished element, member key or member value of the container
+// being parsed
+static Json_state store_push(const Json_store_node *node, const Json_Context *pjc)
+{
+    uint64_t offset;
+    if (!pjc->store_stack->append(sizeof(Json_store_node), offset))
+        return Json_state::IO_ERROR;
+    memcpy(pjc->store_stack->at(offset), node, sizeof(Json_store_node));
+    return Json_state::OK;
+}
+
+// moves the nodes pushed since the stack was at base into the store,
+// as the size elements or members of node
+static Json_state store_pop(Json_store_node *node, Json_type type, size_t size,
+                            uint64_t base, const Json_Context *pjc)
+{
+    Json_store_file &stack = *pjc->store_stack;
+    uint64_t bytes = stack.size() - base, offset = 0;
+
+    if (bytes > 0) {
+        if (!count_bytes(pjc, bytes))
+            return Json_state::MEMORY_LIMIT_EXCEEDED;
+        if (!pjc->store->align(sizeof(uint64_t)) || !pjc->store->append(bytes, offset))
+            return Json_state::IO_ERROR;
+        memcpy(pjc->store->at(offset), stack.at(base), bytes);
+        stack.truncate(base);
+    }
+    set_store_node(node, type, offset, size);
+    return Json_state::OK;
+}
+
+static Json_state store_array(Json_store_node *node, const Json_Context *pjc)
+{
+    ASSERT_STEP(pjc->json_str, '[');
+
+    uint64_t base = pjc->store_stack->size();
+    skip_whitespace(pjc);
+    if (*pjc->json_str == ']') {
+        pjc->json_str++;
+        return store_pop(node, Json_type::JSON_ARRAY, 0, base, pjc);
+    }
+
     Json_state ret_state;
-    std::vector<Json_member*> pm_vec;
+    size_t size = 0;
+
+    while (true) {
+        Json_store_node elem;
+        ret_state = store_value(&elem, pjc);
+        if (ret_state == Json_state::OK)
+            ret_state = store_push(&elem, pjc);
+        if (ret_state != Json_state::OK)
+            return ret_state;
+        size++;
+
+        skip_whitespace(pjc);
+        if (*pjc->json_str == ',') {
+            pjc->json_str++;
+            skip_whitespace(pjc);
+        } else if (*pjc->json_str == ']') {
+            pjc->json_str++;
+            return store_pop(node, Json_type::JSON_ARRAY, size, base, pjc);
+        } else {
+            return Json_state::MISS_COMMA_OR_SQUARE_BRACKET;
+        }
+    }
+}
+
+static Json_state store_object(Json_store_node *node, const Json_Context *pjc)
+{
+    ASSERT_STEP(pjc->json_str, '{');
+
+    uint64_t base = pjc->store_stack->size();
+    skip_whitespace(pjc);
+    if (*pjc->json_str == '}') {
+        pjc->json_str++;
+        return store_pop(node, Json_type::JSON_OBJECT, 0, base, pjc);
+    }
 
-    auto del_pv = [](const std::vector<Json_member*>& pvec) {
-        for (auto & e : pvec)
-            delete e;
-    };
+    Json_state ret_state;
+    size_t size = 0;
 
     while (true) {
-        // Json_member *pjm = (Json_member*)(malloc(sizeof(Json_member)));
-        Json_member *pm_tmp = new Json_member; // need initialize
-        pm_vec.push_back(pm_tmp);
+        Json_store_node key, val;
 
         // parse key
-        if (*pjc->json_str != '"') {
-            del_pv(pm_vec);
+        if (*pjc->json_str != '"')
             return Json_state::MISS_KEY;
-        }
-        ret_state = parse_raw_string(pm_tmp->key, pm_tmp->klen, pjc);
-        if (ret_state != Json_state::OK) {
-            del_pv(pm_vec);
+        ret_state = store_string(&key, pjc);
+        if (ret_state == Json_state::OK)
+            ret_state = store_push(&key, pjc);
+        if (ret_state != Json_state::OK)
             return ret_state;
-        }
 
         // parse comma
         skip_whitespace(pjc);
-        if (*pjc->json_str != ':') {
-            del_pv(pm_vec);
+        if (*pjc->json_str != ':')
             return Json_state::MISS_COLON;
-        }
         pjc->json_str++;
 
         // parse value
         skip_whitespace(pjc);
-        ret_state = parse_value(&pm_tmp->val, pjc);
-        if (ret_state != Json_state::OK) {
-            del_pv(pm_vec);
+        ret_state = store_value(&val, pjc);
+        if (ret_state == Json_state::OK)
+            ret_state = store_push(&val, pjc);
+        if (ret_state != Json_state::OK)
             return ret_state;
-        }
+        size++;
 
         // parse end of member
         skip_whitespace(pjc);
@@ -412,49 +2156,346 @@ static Json_state parse_object(Json_value *pval, const Json_Context *pjc)
             skip_whitespace(pjc);
         } else if (*pjc->json_str == '}') {
             pjc->json_str++;
-            transfer_value_object(pval, pm_vec);
-            return Json_state::OK;
+            return store_pop(node, Json_type::JSON_OBJECT, size, base, pjc);
         } else {
-            del_pv(pm_vec);
             return Json_state::MISS_COMMA_OR_CURLY_BRACKET;
         }
     }
 }
 
-static Json_state parse_value(Json_value *pval, const Json_Context *pjc)
+static Json_state store_value(Json_store_node *node, const Json_Context *pjc)
 {
+    Json_state ret_state = count_node(pjc);
+    if (ret_state != Json_state::OK)
+        return ret_state;
+
+    Json_value v_tmp;
     switch (*pjc->json_str) {
-        case 'n' :  return parse_null(pval, pjc);
-        case 'f' :  return parse_false(pval, pjc);
-        case 't' :  return parse_true(pval, pjc);
-        case '\"' : return parse_string(pval, pjc);
-        case '[' :  return parse_array(pval, pjc);
-        case '{' :  return parse_object(pval, pjc);
+        case 'n' :  ret_state = parse_null(&v_tmp, pjc);  break;
+        case 'f' :  ret_state = parse_false(&v_tmp, pjc); break;
+        case 't' :  ret_state = parse_true(&v_tmp, pjc);  break;
+        case '\"' : return store_string(node, pjc);
+        case '[' :
+        case '{' :
+            if (pjc->depth == pjc->max_depth)
+                return Json_state::DEPTH_LIMIT_EXCEEDED;
+            pjc->depth++;
+            ret_state = *pjc->json_str == '[' ? store_array(node, pjc) :
+                                                store_object(node, pjc);
+            pjc->depth--;
+            return ret_state;
         case '\0' : return Json_state::EXPECT_VALUE;
-        // default :   return Json_state::INVALID_VALUE;
-        default :   return parse_number(pval, pjc);
+        default :   ret_state = parse_number(&v_tmp, pjc); break;
     }
+    if (ret_state == Json_state::OK) {
+        uint64_t bits = 0;
+        if (v_tmp.type == Json_type::JSON_NUMBER)
+            memcpy(&bits, &v_tmp.number, sizeof(bits));
+        set_store_node(node, v_tmp.type, bits, 0);
+    }
+    return ret_state;
 }
 
-Json_state Json::parse(Json_value *pval, const std::string& json_str)
+Json_state Json::parse_store(const char *json_path, const char *store_path)
 {
-    Json_Context jc;
-    Json_state   state;
+    Json_text_file  text;
+    Json_store_file store, stack;
+    uint64_t        offset;
+
+    if (!text.open(json_path) || !store.create(store_path, false))
+        return Json_state::IO_ERROR;
+    // pending nodes spill to a temporary file next to the store rather
+    // than into memory
+    if (!stack.create(std::string(store_path) + ".stack", true) ||
+        !store.append(sizeof(Json_store_header), offset)) {
+        store.close();
+        std::remove(store_path);
+        return Json_state::IO_ERROR;
+    }
+
+    Json_Context    jc;
+    Json_state      state;
+    Json_store_node root;
 
-    jc.json_str = json_str.c_str();
-    jc.json_len = json_str.size() + 1;
-    assert(jc.json_str[json_str.size()] == '\0');
+    init_context(&jc, text.data(), text.size());
+    jc.store = &store;
+    jc.store_stack = &stack;
 
-    skip_whitespace(&jc);
-    state = parse_value(pval, &jc);
+    try {
+        skip_whitespace(&jc);
+        state = store_value(&root, &jc);
+    } catch (const std::bad_alloc&) {
+        state = Json_state::OUT_OF_MEMORY;
+    }
 
     if (state == Json_state::OK) {
         skip_whitespace(&jc);
         if (*jc.json_str != '\0')
             state = Json_state::ROOT_NOT_SINGULAR;
     }
-    
+    if (state == Json_state::OK) {
+        Json_store_header *header = (Json_store_header*)store.at(0);
+        header->root = root;
+        memcpy(header->magic, JSON_STORE_MAGIC, sizeof(header->magic));
+    }
+
+    release_context(&jc);
+    if (!store.close() && state == Json_state::OK)
+        state = Json_state::IO_ERROR;
+    if (state != Json_state::OK)
+        std::remove(store_path);
     return state;
 }
 
+Json_state Json::validate(const std::string& json_str)
+{
+    return scan(json_str, nullptr);
+}
+
+Json_state Json::minify(const std::string& json_str, std::string& out)
+{
+    out.clear();
+    out.reserve(json_str.size());
+    return scan(json_str, &out);
+}
+
+void Json::set_validate_utf8(bool validate)
+{
+    validate_utf8_ = validate;
+}
+
+Json_limits::Json_limits()
+    : max_depth(0), max_nodes(0), max_string_length(0), max_total_bytes(0),
+      timeout_us(0)
+{
+}
+
+void Json::set_limits(const Json_limits& limits)
+{
+    limits_ = limits;
+}
+
+void Json::set_schema(const Json_schema *schema)
+{
+    schema_ = schema;
+}
+
+void Json::set_allocator(Json_allocator *alloc)
+{
+    alloc_ = alloc;
+}
+
+void Json::set_pack_numbers(bool pack)
+{
+    pack_numbers_ = pack;
+}
+
+void Json::stringify(std::string& json_str, const Json_value* jv)
+{
+    json_str.clear();
+    Json_string_sink sink(json_str);
+    Json_writer writer(sink);
+    writer.value(jv);
+    writer.flush();
+}
+
+// next code point of a UTF-8 string, a malformed byte stands for itself
+static unsigned next_code_point(const char *&p, const char *end)
+{
+    const unsigned char *u = (const unsigned char*)p;
+    size_t len = end - p;
+    unsigned cp = u[0];
+
+    if (cp >= 0xC0 && cp < 0xE0 && len >= 2) {
+        cp = ((cp & 0x1F) << 6) | (u[1] & 0x3F);
+        p += 2;
+    } else if (cp >= 0xE0 && cp < 0xF0 && len >= 3) {
+        cp = ((cp & 0x0F) << 12) | ((u[1] & 0x3F) << 6) | (u[2] & 0x3F);
+        p += 3;
+    } else if (cp >= 0xF0 && len >= 4) {
+        cp = ((cp & 0x07) << 18) | ((u[1] & 0x3F) << 12) |
+             ((u[2] & 0x3F) << 6) | (u[3] & 0x3F);
+        p += 4;
+    } else {
+        p += 1;
+    }
+    return cp;
+}
+
+// orders keys by their UTF-16 code units as RFC 8785 requires; only
+// differs from code point order when a BMP char meets a surrogate pair
+static bool utf16_less(const Json_member *a, const Json_member *b)
+{
+    const char *pa = a->get_key(), *ea = pa + a->get_key_length();
+    const char *pb = b->get_key(), *eb = pb + b->get_key_length();
+
+    while (pa < ea && pb < eb) {
+        unsigned ca = next_code_point(pa, ea);
+        unsigned cb = next_code_point(pb, eb);
+        if (ca == cb)
+            continue;
+        if ((ca >= 0x10000) != (cb >= 0x10000)) {
+            unsigned ua = ca >= 0x10000 ? 0xD800 + ((ca - 0x10000) >> 10) : ca;
+            unsigned ub = cb >= 0x10000 ? 0xD800 + ((cb - 0x10000) >> 10) : cb;
+            if (ua != ub)
+                return ua < ub;
+        }
+        return ca < cb;
+    }
+    return pa == ea && pb < eb;
+}
+
+// ECMAScript Number.prototype.toString() of a finite double
+// false for NaN and infinities, which RFC 8785 does not allow
+static bool put_canonical_number(std::string &s, double n)
+{
+    if (!std::isfinite(n))
+        return false;
+    if (n == 0.0) { // -0 too
+        PUTC(s, '0');
+        return true;
+    }
+    if (n < 0) {
+        PUTC(s, '-');
+        n = -n;
+    }
+
+    // shortest digits that read back as n
+    char buf[32];
+    for (int prec = 1; prec <= 17; ++prec) {
+        snprintf(buf, sizeof(buf), "%.*e", prec - 1, n);
+        if (std::strtod(buf, nullptr) == n)
+            break;
+    }
+
+    char digits[20];
+    int  k = 0;
+    const char *p = buf;
+    for (; *p != 'e'; ++p) {
+        if (*p != '.')
+            digits[k++] = *p;
+    }
+    while (k > 1 && digits[k - 1] == '0')
+        k--;
+    int pos = atoi(p + 1) + 1; // position of the decimal point
+
+    if (k <= pos && pos <= 21) {
+        s.append(digits, k);
+        s.append(pos - k, '0');
+    } else if (0 < pos && pos <= 21) {
+        s.append(digits, pos);
+        PUTC(s, '.');
+        s.append(digits + pos, k - pos);
+    } else if (-6 < pos && pos <= 0) {
+        s.append("0.");
+        s.append(-pos, '0');
+        s.append(digits, k);
+    } else {
+        PUTC(s, digits[0]);
+        if (k > 1) {
+            PUTC(s, '.');
+            s.append(digits + 1, k - 1);
+        }
+        PUTC(s, 'e');
+        PUTC(s, pos - 1 >= 0 ? '+' : '-');
+        s.append(std::to_string(pos - 1 >= 0 ? pos - 1 : 1 - pos));
+    }
+    return true;
+}
+
+static void put_canonical_string(std::string &s, const char *str, size_t len)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+
+    PUTC(s, '"');
+    for (const char *p = str, *end = str + len; p < end; ++p) {
+        unsigned char ch = (unsigned char)*p;
+        switch (ch) {
+            case '\"' : s.append("\\\""); break;
+            case '\\' : s.append("\\\\"); break;
+            case '\b' : s.append("\\b");  break;
+            case '\f' : s.append("\\f");  break;
+            case '\n' : s.append("\\n");  break;
+            case '\r' : s.append("\\r");  break;
+            case '\t' : s.append("\\t");  break;
+            default :
+                if (ch < 0x20) {
+                    s.append("\\u00");
+                    PUTC(s, hex_digits[ch >> 4]);
+                    PUTC(s, hex_digits[ch & 15]);
+                } else {
+                    PUTC(s, ch);
+                }
+        }
+    }
+    PUTC(s, '"');
+}
+
+static bool put_canonical_value(std::string &s, const Json_value *pv)
+{
+    switch (pv->type) {
+        case Json_type::JSON_NULL :   s.append("null");  break;
+        case Json_type::JSON_FALSE :  s.append("false"); break;
+        case Json_type::JSON_TRUE :   s.append("true");  break;
+        case Json_type::JSON_NUMBER : return put_canonical_number(s, pv->number);
+        case Json_type::JSON_STRING :
+            put_canonical_string(s, pv->get_string(), pv->get_string_length());
+            break;
+        case Json_type::JSON_ARRAY :
+            PUTC(s, '[');
+            for (size_t i = 0; i < pv->arr.size; ++i) {
+                if (i > 0)
+                    PUTC(s, ',');
+                if (pv->is_packed() ? !put_canonical_number(s, pv->narr.num[i]) :
+                                      !put_canonical_value(s, &pv->arr.elem[i]))
+                    return false;
+            }
+            PUTC(s, ']');
+            break;
+        case Json_type::JSON_OBJECT : {
+            std::vector<const Json_member*> sorted(pv->obj.size);
+            for (size_t i = 0; i < pv->obj.size; ++i)
+                sorted[i] = &pv->obj.mem[i];
+            std::sort(sorted.begin(), sorted.end(), utf16_less);
+
+            PUTC(s, '{');
+            for (size_t i = 0; i < sorted.size(); ++i) {
+                if (i > 0)
+                    PUTC(s, ',');
+                put_canonical_string(s, sorted[i]->get_key(),
+                                     sorted[i]->get_key_length());
+                PUTC(s, ':');
+                if (!put_canonical_value(s, &sorted[i]->val))
+                    return false;
+            }
+            PUTC(s, '}');
+            break;
+        }
+    }
+    return true;
+}
+
+Json_state Json::stringify_canonical(std::string& json_str, const Json_value* jv)
+{
+    json_str.clear();
+    if (!put_canonical_value(json_str, jv)) {
+        json_str.clear();
+        return Json_state::NUMBER_NOT_FINITE;
+    }
+    return Json_state::OK;
+}
+
+void Json::reset()
+{
+    free(stack_);
+    stack_ = nullptr;
+    stack_size_ = 0;
+    std::string().swap(sbuf_);
+}
+
+void Json::set_scratch_limit(size_t bytes)
+{
+    scratch_limit_ = bytes;
+}
+
 } // end namespace JsonParser
\ No newline at end of file
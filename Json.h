@@ -5,7 +5,10 @@
 #include <crtdbg.h>
 #endif
 
+#include <cstdint>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace JsonParser
 {
@@ -34,40 +37,358 @@ enum Json_state {
     MISS_COMMA_OR_SQUARE_BRACKET,
     MISS_KEY,
     MISS_COLON,
-    MISS_COMMA_OR_CURLY_BRACKET
+    MISS_COMMA_OR_CURLY_BRACKET,
+    INVALID_UTF8,
+    INVALID_PATCH,
+    PATCH_PATH_NOT_FOUND,
+    PATCH_TEST_FAILED,
+    DEPTH_LIMIT_EXCEEDED,
+    NODE_LIMIT_EXCEEDED,
+    STRING_TOO_LONG,
+    MEMORY_LIMIT_EXCEEDED,
+    DEADLINE_EXCEEDED,
+    DECOMPRESSION_ERROR,
+    INVALID_SCHEMA,
+    SCHEMA_MISMATCH,
+    COLUMN_MISMATCH,
+    IO_ERROR,
+    NUMBER_NOT_FINITE,
+    OUT_OF_MEMORY
 };
 
+enum Json_value_flag {
+    JSON_PACKED_NUMBERS = 0x01, // array of numbers stored in narr.num
+    JSON_INLINE_STRING  = 0x02, // string stored in sstr
+    JSON_BORROWED       = 0x04, // contents owned by another, read only tree
+    JSON_ALLOCATED      = 0x08, // contents from a Json_allocator
+    JSON_SPARE_CAPACITY = 0x10  // elements or members have room past size
+};
+
+// longest string or key kept inside Json_value/Json_member itself. keys
+// give a byte up to the member's flags.
+#define JSON_INLINE_CAPACITY (sizeof(char*) + sizeof(size_t) - 1)
+#define JSON_KEY_INLINE_CAPACITY (JSON_INLINE_CAPACITY - 1)
+
 struct Json_member;
+struct Json_Context;
+class Json_schema;
+
+struct Json_allocator_stats {
+    Json_allocator_stats();
+
+    uint64_t allocations;
+    uint64_t deallocations;
+    uint64_t bytes_in_use;  // allocated and not yet deallocated
+    uint64_t peak_bytes;    // highest bytes_in_use so far
+};
+
+// Source of the storage of trees: element, member and packed number
+// arrays, and the strings and keys too long to be stored inline. Each
+// block records the allocator it came from, so trees may mix
+// allocators and are freed correctly by whichever thread drops them.
+// Without one (nullptr, the default) storage comes from malloc/free.
+// see JsonAllocator.h for the allocators provided.
+class Json_allocator
+{
+public:
+    virtual ~Json_allocator() {}
+
+    // bytes aligned for any type, throws std::bad_alloc on failure.
+    // Json's parsing calls report that as OUT_OF_MEMORY, setters and
+    // mutators of Json_value let it through.
+    virtual void* allocate(size_t bytes) = 0;
+    // a block of this allocator, maybe returned by another thread
+    virtual void deallocate(void *p, size_t bytes) = 0;
+    virtual Json_allocator_stats stats() const = 0;
+
+    // the allocator of the values built by Json_value's setters, copy()
+    // and mutators on the calling thread. Json::parse() has its own,
+    // see Json::set_allocator().
+    static Json_allocator* current();
+    static void set_current(Json_allocator *alloc);
+};
+
+// makes alloc the current allocator of the thread while in scope
+class Json_allocator_scope
+{
+public:
+    explicit Json_allocator_scope(Json_allocator *alloc)
+        : prev_(Json_allocator::current()) { Json_allocator::set_current(alloc); }
+    ~Json_allocator_scope() { Json_allocator::set_current(prev_); }
+
+    Json_allocator_scope(const Json_allocator_scope&) = delete;
+    Json_allocator_scope& operator=(const Json_allocator_scope&) = delete;
+
+private:
+    Json_allocator *prev_;
+};
 
 struct Json_value {
     Json_value();
     ~Json_value();
 
+    // member lookup for objects, nullptr if absent or not an object.
+    // a key obtained from the same Json_symbol_table the document was
+    // parsed with is matched by pointer before falling back to memcmp.
+    Json_value* find(const char *key, size_t klen);
+    const Json_value* find(const char *key, size_t klen) const;
+
+    // mutation, each setter releases the previous contents first
+    void set_null();
+    void set_boolean(bool b);
+    void set_number(double n);
+    void set_string(const char *s, size_t len);
+    void set_array(size_t size = 0); // size null elements
+    void set_object(size_t size = 0); // size members, empty keys and null values
+    void copy(const Json_value *src); // deep copy
+    void move(Json_value *src);       // src is left null
+
+    // arrays: insert a null element before index (size appends)
+    Json_value* insert_element(size_t index);
+    void erase_element(size_t index);
+    // objects: the value of key, appending a null member if absent
+    Json_value* set_member(const char *key, size_t klen);
+    bool erase_member(const char *key, size_t klen);
+
+    // deep equality, object members compare regardless of their order
+    // (repeated keys included, as a multiset)
+    bool equals(const Json_value *other) const;
+    // structural hash: equal values hash equal, member order is ignored
+    uint64_t hash() const;
+
+    // arrays whose elements are all numbers may be packed: narr.num
+    // replaces arr.elem (sizes are shared), see Json::set_pack_numbers()
+    bool is_packed() const { return (flags & JSON_PACKED_NUMBERS) != 0; }
+    void set_packed(const double *num, size_t size);
+    void unpack(); // packed array back to elements, no-op otherwise
+
+    // string contents, '\0' terminated. strings of up to
+    // JSON_INLINE_CAPACITY bytes are stored inline in sstr, longer ones
+    // in str, so read them through these rather than the union.
+    const char* get_string() const
+    { return (flags & JSON_INLINE_STRING) ? sstr : str.pch; }
+    size_t get_string_length() const
+    { return (flags & JSON_INLINE_STRING) ?
+             JSON_INLINE_CAPACITY - sstr[JSON_INLINE_CAPACITY] : str.len; }
+
     union {
         struct { Json_member *mem; size_t size; } obj;
         struct { Json_value *elem; size_t size; } arr;
+        struct { double *num; size_t size; } narr;
         struct { char *pch; size_t len; } str;
+        char sstr[JSON_INLINE_CAPACITY + 1];
         double number;
     };
     Json_type type;
+    unsigned char flags;
+};
+
+enum Json_key_flag {
+    JSON_KEY_INTERNED  = 0x01,  // key is owned by a Json_symbol_table
+    JSON_KEY_INLINE    = 0x02,  // key stored in skey
+    JSON_KEY_BORROWED  = 0x04,  // key owned by another, read only tree
+    JSON_KEY_ALLOCATED = 0x08   // key from a Json_allocator
 };
 
 struct Json_member {
     Json_member();
     ~Json_member();
 
-    char *key; size_t klen;
+    void set_key(const char *key, size_t klen); // copies key
+
+    // the key, '\0' terminated, stored inline like short strings
+    const char* get_key() const
+    { return (kflags & JSON_KEY_INLINE) ? skey : key; }
+    size_t get_key_length() const
+    { return (kflags & JSON_KEY_INLINE) ?
+             JSON_KEY_INLINE_CAPACITY - skey[JSON_KEY_INLINE_CAPACITY] : (size_t)klen; }
+
+    // kflags takes the top byte of klen, the last of the union whichever
+    // the byte order, past the end of skey
+    union {
+        struct { char *key; uint64_t klen : 56; uint64_t kflags : 8; };
+        char skey[JSON_KEY_INLINE_CAPACITY + 1];
+    };
     Json_value val;
 };
 
+static_assert(sizeof(Json_member) == 16 + sizeof(Json_value),
+              "key flags must not grow Json_member");
+
+// Stores each distinct key once. Documents parsed with a table keep
+// pointers into it, so the table must outlive them.
+class Json_symbol_table
+{
+public:
+    explicit Json_symbol_table(bool thread_safe = false);
+    ~Json_symbol_table();
+
+    Json_symbol_table(const Json_symbol_table&) = delete;
+    Json_symbol_table& operator=(const Json_symbol_table&) = delete;
+
+    // returns the interned, '\0' terminated copy of key
+    const char* intern(const char *key, size_t klen);
+    // returns the interned copy of key, nullptr if never interned
+    const char* lookup(const char *key, size_t klen) const;
+    size_t size() const;
+
+    // FNV-1a of key, the hash of the tables of keys here and elsewhere
+    static size_t hash(const char *key, size_t klen);
+
+    // process wide, thread safe table
+    static Json_symbol_table& global();
+
+private:
+    struct Slot { const char *key; size_t klen; size_t hash; };
+
+    const char* find_slot(const char *key, size_t klen, size_t hash,
+                          size_t &pos) const;
+    const char* insert(const char *key, size_t klen, size_t hash, size_t pos);
+    void rehash();
+    char* store(const char *key, size_t klen);
+
+    std::vector<Slot>  slots_;
+    std::vector<char*> chunks_;
+    char              *chunk_cur_;
+    size_t             chunk_left_;
+    size_t             count_;
+    bool               thread_safe_;
+    mutable std::mutex mutex_;
+};
+
+enum Json_column_type {
+    JSON_COLUMN_DOUBLE, // numbers, into f64
+    JSON_COLUMN_INT64,  // numbers with an integral value, into i64
+    JSON_COLUMN_STRING  // strings, into offsets and bytes
+};
+
+// One field of an array of records, stored struct-of-arrays style by
+// Json::parse_columns(). Row i of a string column is
+// bytes[offsets[i], offsets[i + 1]). Rows where the field is null or
+// missing have bit i % 8 of valid[i / 8] cleared, as in Apache Arrow,
+// and hold 0 or an empty string.
+struct Json_column {
+    Json_column(const std::string &name, Json_column_type type);
+
+    bool is_valid(size_t row) const { return (valid[row >> 3] >> (row & 7)) & 1; }
+    void clear(); // drops the rows, keeping name and type
+
+    std::string           name;
+    Json_column_type      type;
+    size_t                size;       // rows
+    size_t                null_count;
+    std::vector<uint8_t>  valid;
+    std::vector<double>   f64;
+    std::vector<int64_t>  i64;
+    std::vector<uint64_t> offsets;    // size + 1 entries
+    std::string           bytes;
+};
+
+// per call budgets of Json::parse/validate/minify, 0 means unlimited
+struct Json_limits {
+    Json_limits();
+
+    size_t   max_depth;         // nesting of arrays and objects
+    size_t   max_nodes;         // values of any type
+    size_t   max_string_length; // decoded bytes of one string or key
+    size_t   max_total_bytes;   // bytes allocated for the tree
+    uint64_t timeout_us;        // wall clock, checked every few nodes
+};
+
 class Json
 {
 public:
     Json();
     ~Json();
 
-    Json_state parse(Json_value* jv, const std::string& json_str);
+    Json(const Json&) = delete;
+    Json& operator=(const Json&) = delete;
+
+    // when hash is given it receives jv->hash(), computed while parsing.
+    // this and the other parsing calls return OUT_OF_MEMORY rather than
+    // throw when storage runs out, the tree built so far is released.
+    Json_state parse(Json_value* jv, const std::string& json_str,
+                     uint64_t *hash = nullptr);
+    // the len bytes at json, which must be followed by a '\0'
+    Json_state parse(Json_value* jv, const char *json, size_t len,
+                     uint64_t *hash = nullptr);
     void stringify(std::string& json_str, const Json_value* jv);
+    // RFC 8785 (JCS) canonical form: sorted members, no whitespace and
+    // ECMAScript number formatting. NUMBER_NOT_FINITE, with json_str
+    // left empty, if jv holds a NaN or an infinity.
+    Json_state stringify_canonical(std::string& json_str, const Json_value* jv);
+
+    // same syntax checks and states as parse() without building a
+    // tree. the schema of set_schema() is not checked, parse for that.
+    Json_state validate(const std::string& json_str);
+    // copies json_str to out with insignificant whitespace removed,
+    // out is only meaningful when OK is returned
+    Json_state minify(const std::string& json_str, std::string& out);
+
+    // parses json_str, an array of objects, straight into columns
+    // without building a tree: every object adds a row to each column,
+    // taken from its member of the same name (the first, if repeated).
+    // other members are checked but not stored. COLUMN_MISMATCH if
+    // json_str is not an array of objects or a member does not convert
+    // to its column's type. columns are cleared first and only
+    // meaningful when OK is returned.
+    Json_state parse_columns(const std::string& json_str,
+                             std::vector<Json_column>& columns);
+
+    // parses the file json_path into a store file at store_path, to be
+    // read through Json_store, keeping neither the text nor the tree in
+    // memory. IO_ERROR if a file cannot be mapped or grown, and always
+    // on _WINDOWS builds, which have no store; store_path is removed
+    // unless OK is returned.
+    Json_state parse_store(const char *json_path, const char *store_path);
+
+    // intern object keys into symtab (nullptr to disable, the default)
+    void set_symbol_table(Json_symbol_table *symtab);
+
+    // reject strings that are not well formed UTF-8 with INVALID_UTF8
+    void set_validate_utf8(bool validate);
+
+    // budgets enforced by every later call, exceeding one fails it with
+    // the matching *_LIMIT_EXCEEDED, STRING_TOO_LONG or DEADLINE_EXCEEDED
+    void set_limits(const Json_limits& limits);
+
+    // store arrays holding only numbers as packed double arrays
+    void set_pack_numbers(bool pack);
+
+    // where parse() takes the storage of the trees it builds (nullptr
+    // for malloc, the default); alloc must outlive those trees
+    void set_allocator(Json_allocator *alloc);
+
+    // check documents against schema while parsing them (nullptr to
+    // disable, the default). a document that does not conform fails
+    // with SCHEMA_MISMATCH as soon as the offending value is complete,
+    // schema_path() then points to it.
+    void set_schema(const Json_schema *schema);
+    const std::string& schema_path() const { return schema_path_; }
+
+    // scratch buffers are kept across calls; reset() releases them and
+    // after each call any buffer grown past the limit is released too
+    void reset();
+    void set_scratch_limit(size_t bytes);
+
+private:
+    void init_context(Json_Context *pjc, const std::string &json_str);
+    void init_context(Json_Context *pjc, const char *json, size_t len);
+    void release_context(Json_Context *pjc);
+    Json_state scan(const std::string& json_str, std::string *out);
+
+    Json_symbol_table *symtab_;
+    bool               validate_utf8_;
+    bool               pack_numbers_;
+    Json_limits        limits_;
+    Json_allocator    *alloc_;
+    const Json_schema *schema_;
+    std::string        schema_path_;
+
+    std::string sbuf_;
+    char       *stack_;
+    size_t      stack_size_;
+    size_t      scratch_limit_;
 };
 
 } // end of JsonParser
@@ -0,0 +1,253 @@
+#include "JsonAllocator.h"
+
+#include <cstdlib>
+#include <new>
+
+// pool blocks are multiples of JSON_POOL_GRANULE, which keeps them
+// aligned for any type, carved from chunks of JSON_POOL_CHUNK_SIZE
+#define JSON_POOL_GRANULE 16
+#ifndef JSON_POOL_CHUNK_SIZE
+#define JSON_POOL_CHUNK_SIZE (64 * 1024)
+#endif
+
+namespace JsonParser
+{
+
+// ------------------------------------------------------------ counters
+
+Json_allocator_counters::Json_allocator_counters()
+    : allocations_(0), deallocations_(0), bytes_in_use_(0), peak_bytes_(0)
+{
+}
+
+void Json_allocator_counters::allocated(size_t bytes)
+{
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t in_use = bytes_in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    uint64_t peak = peak_bytes_.load(std::memory_order_relaxed);
+    while (in_use > peak &&
+           !peak_bytes_.compare_exchange_weak(peak, in_use, std::memory_order_relaxed))
+        ;
+}
+
+void Json_allocator_counters::deallocated(size_t bytes)
+{
+    deallocations_.fetch_add(1, std::memory_order_relaxed);
+    bytes_in_use_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+Json_allocator_stats Json_allocator_counters::get() const
+{
+    Json_allocator_stats stats;
+    stats.allocations   = allocations_.load(std::memory_order_relaxed);
+    stats.deallocations = deallocations_.load(std::memory_order_relaxed);
+    stats.bytes_in_use  = bytes_in_use_.load(std::memory_order_relaxed);
+    stats.peak_bytes    = peak_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// ------------------------------------------------------------ malloc
+
+void* Json_malloc_allocator::allocate(size_t bytes)
+{
+    void *p = malloc(bytes);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    counters_.allocated(bytes);
+    return p;
+}
+
+void Json_malloc_allocator::deallocate(void *p, size_t bytes)
+{
+    free(p);
+    counters_.deallocated(bytes);
+}
+
+// ------------------------------------------------------------ pool
+
+Json_pool_allocator::Json_pool_allocator()
+    : owner_(std::this_thread::get_id()), has_remote_(false),
+      remote_deallocations_(0), remote_bytes_(0)
+{
+    for (size_t i = 0; i < CLASSES; ++i)
+        free_[i] = remote_[i] = nullptr;
+}
+
+Json_pool_allocator::~Json_pool_allocator()
+{
+    for (void *chunk : chunks_)
+        free(chunk);
+}
+
+void* Json_pool_allocator::allocate(size_t bytes)
+{
+    void *p;
+    size_t cls = (bytes + JSON_POOL_GRANULE - 1) / JSON_POOL_GRANULE;
+    if (cls == 0 || cls > CLASSES) {
+        p = malloc(bytes);
+        if (p == nullptr)
+            throw std::bad_alloc();
+    } else {
+        Free_block *b = free_[cls - 1];
+        if (b == nullptr)
+            b = refill(cls - 1);
+        free_[cls - 1] = b->next;
+        p = b;
+    }
+
+    stats_.allocations++;
+    stats_.bytes_in_use += bytes;
+    if (stats_.bytes_in_use > stats_.peak_bytes)
+        stats_.peak_bytes = stats_.bytes_in_use;
+    return p;
+}
+
+void Json_pool_allocator::deallocate(void *p, size_t bytes)
+{
+    size_t cls = (bytes + JSON_POOL_GRANULE - 1) / JSON_POOL_GRANULE;
+    bool large = cls == 0 || cls > CLASSES;
+
+    if (owner_.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+        if (large) {
+            free(p);
+        } else {
+            Free_block *b = (Free_block*)p;
+            b->next = free_[cls - 1];
+            free_[cls - 1] = b;
+        }
+        stats_.deallocations++;
+        stats_.bytes_in_use -= bytes;
+        return;
+    }
+
+    if (large)
+        free(p); // malloc's own, nothing to give back
+    std::lock_guard<std::mutex> lock(remote_mutex_);
+    if (!large) {
+        Free_block *b = (Free_block*)p;
+        b->next = remote_[cls - 1];
+        remote_[cls - 1] = b;
+    }
+    remote_deallocations_++;
+    remote_bytes_ += bytes;
+    has_remote_.store(true, std::memory_order_release);
+}
+
+// moves the blocks other threads returned to the free lists
+void Json_pool_allocator::take_remote()
+{
+    std::lock_guard<std::mutex> lock(remote_mutex_);
+    for (size_t i = 0; i < CLASSES; ++i) {
+        while (remote_[i] != nullptr) {
+            Free_block *b = remote_[i];
+            remote_[i] = b->next;
+            b->next = free_[i];
+            free_[i] = b;
+        }
+    }
+    stats_.deallocations += remote_deallocations_;
+    stats_.bytes_in_use  -= remote_bytes_;
+    remote_deallocations_ = remote_bytes_ = 0;
+    has_remote_.store(false, std::memory_order_relaxed);
+}
+
+Json_pool_allocator::Free_block* Json_pool_allocator::refill(size_t cls)
+{
+    if (has_remote_.load(std::memory_order_acquire)) {
+        take_remote();
+        if (free_[cls] != nullptr)
+            return free_[cls];
+    }
+
+    size_t block = (cls + 1) * JSON_POOL_GRANULE;
+    size_t count = JSON_POOL_CHUNK_SIZE / block;
+    char *chunk = (char*)malloc(count * block);
+    if (chunk == nullptr)
+        throw std::bad_alloc();
+    chunks_.push_back(chunk);
+
+    for (size_t i = 0; i < count; ++i) {
+        Free_block *b = (Free_block*)(chunk + i * block);
+        b->next = free_[cls];
+        free_[cls] = b;
+    }
+    return free_[cls];
+}
+
+Json_allocator_stats Json_pool_allocator::stats() const
+{
+    Json_allocator_stats stats = stats_;
+    std::lock_guard<std::mutex> lock(remote_mutex_);
+    stats.deallocations += remote_deallocations_;
+    stats.bytes_in_use  -= remote_bytes_;
+    return stats;
+}
+
+// pools of exited threads, waiting for new ones. they are never
+// destroyed: blocks of trees that outlived their thread point into them.
+static std::mutex& idle_pools_mutex()
+{
+    static std::mutex *mutex = new std::mutex;
+    return *mutex;
+}
+
+static std::vector<Json_pool_allocator*>& idle_pools()
+{
+    static std::vector<Json_pool_allocator*> *pools = new std::vector<Json_pool_allocator*>;
+    return *pools;
+}
+
+// gives the pool of a thread up when it exits
+struct Json_pool_slot {
+    Json_pool_slot() : pool(nullptr) {}
+    ~Json_pool_slot()
+    {
+        if (pool == nullptr)
+            return;
+        pool->owner_.store(std::thread::id()); // no thread's
+        std::lock_guard<std::mutex> lock(idle_pools_mutex());
+        idle_pools().push_back(pool);
+    }
+
+    Json_pool_allocator *pool;
+};
+
+static thread_local Json_pool_slot local_pool;
+
+Json_pool_allocator& Json_pool_allocator::local()
+{
+    if (local_pool.pool == nullptr) {
+        Json_pool_allocator *pool = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(idle_pools_mutex());
+            if (!idle_pools().empty()) {
+                pool = idle_pools().back();
+                idle_pools().pop_back();
+            }
+        }
+        if (pool == nullptr)
+            pool = new Json_pool_allocator;
+        pool->owner_.store(std::this_thread::get_id());
+        local_pool.pool = pool;
+    }
+    return *local_pool.pool;
+}
+
+// ------------------------------------------------------------ pmr
+
+#ifdef JSONPARSER_HAVE_PMR
+void* Json_pmr_allocator::allocate(size_t bytes)
+{
+    void *p = resource_->allocate(bytes, alignof(std::max_align_t));
+    counters_.allocated(bytes);
+    return p;
+}
+
+void Json_pmr_allocator::deallocate(void *p, size_t bytes)
+{
+    resource_->deallocate(p, bytes, alignof(std::max_align_t));
+    counters_.deallocated(bytes);
+}
+#endif
+
+} // end namespace JsonParser
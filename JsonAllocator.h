@@ -0,0 +1,123 @@
+#ifndef __JSONPARSER_JSONALLOCATOR_H_
+#define __JSONPARSER_JSONALLOCATOR_H_
+
+#include "Json.h"
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define JSONPARSER_HAVE_PMR
+#endif
+#endif
+
+namespace JsonParser
+{
+
+// thread safe counters behind stats()
+class Json_allocator_counters
+{
+public:
+    Json_allocator_counters();
+
+    void allocated(size_t bytes);
+    void deallocated(size_t bytes);
+    Json_allocator_stats get() const;
+
+private:
+    std::atomic<uint64_t> allocations_, deallocations_, bytes_in_use_, peak_bytes_;
+};
+
+// malloc/free, as trees use without an allocator, with statistics
+class Json_malloc_allocator : public Json_allocator
+{
+public:
+    void* allocate(size_t bytes) override;
+    void deallocate(void *p, size_t bytes) override;
+    Json_allocator_stats stats() const override { return counters_.get(); }
+
+private:
+    Json_allocator_counters counters_;
+};
+
+// Size class pool for the small blocks trees are made of (arrays of a
+// few values or members, strings): blocks of up to 512 bytes are
+// carved from large chunks and recycled through per class free lists,
+// without locking or calling malloc. Bigger blocks go to malloc.
+//
+// A pool belongs to one thread, which alone may allocate from it and
+// read its stats(). Blocks may be returned from any thread: those of
+// other threads are queued and taken back when the owner runs short.
+// Chunks are released when the pool is destroyed, after every block
+// has been returned.
+class Json_pool_allocator : public Json_allocator
+{
+public:
+    Json_pool_allocator(); // owned by the calling thread
+    ~Json_pool_allocator();
+
+    Json_pool_allocator(const Json_pool_allocator&) = delete;
+    Json_pool_allocator& operator=(const Json_pool_allocator&) = delete;
+
+    void* allocate(size_t bytes) override;
+    void deallocate(void *p, size_t bytes) override;
+    Json_allocator_stats stats() const override;
+
+    // the calling thread's pool. the pools of threads that exit are
+    // handed to new threads rather than destroyed, so trees may
+    // outlive the thread that built them.
+    static Json_pool_allocator& local();
+
+private:
+    struct Free_block { Free_block *next; };
+
+    Free_block* refill(size_t cls);
+    void take_remote();
+
+    friend struct Json_pool_slot;
+
+    static const size_t CLASSES = 32; // 16 bytes apart
+
+    Free_block          *free_[CLASSES];
+    std::vector<void*>   chunks_;
+    Json_allocator_stats stats_;
+
+    std::atomic<std::thread::id> owner_;
+
+    // blocks returned by other threads
+    mutable std::mutex remote_mutex_;
+    std::atomic<bool>  has_remote_;
+    Free_block        *remote_[CLASSES];
+    uint64_t           remote_deallocations_, remote_bytes_;
+};
+
+#ifdef JSONPARSER_HAVE_PMR
+// trees stored in a std::pmr::memory_resource, thread safe if the
+// resource is. needs C++17, see the _cxx17 targets of CMakeLists.txt.
+class Json_pmr_allocator : public Json_allocator
+{
+public:
+    explicit Json_pmr_allocator(std::pmr::memory_resource *resource =
+                                std::pmr::get_default_resource())
+        : resource_(resource) {}
+
+    void* allocate(size_t bytes) override;
+    void deallocate(void *p, size_t bytes) override;
+    Json_allocator_stats stats() const override { return counters_.get(); }
+
+    std::pmr::memory_resource* resource() const { return resource_; }
+
+private:
+    std::pmr::memory_resource *resource_;
+    Json_allocator_counters    counters_;
+};
+#endif
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONALLOCATOR_H_
@@ -0,0 +1,160 @@
+#include "JsonDocument.h"
+#include "JsonPatch.h"
+
+#include <cstring>
+
+#define KEY_ARG(m) (m).get_key(), (m).get_key_length()
+
+// longest chain of bases a derived document may keep alive, derive()
+// flattens past it
+#ifndef JSON_DOCUMENT_MAX_CHAIN
+#define JSON_DOCUMENT_MAX_CHAIN 16
+#endif
+
+namespace JsonParser
+{
+
+Json_document::~Json_document()
+{
+    // borrowed values are skipped by set_null(), base_ frees them
+    root_.set_null();
+}
+
+Json_document_ptr Json_document::make(Json_value *root)
+{
+    std::shared_ptr<Json_document> doc(new Json_document);
+    doc->root_.move(root);
+    return doc;
+}
+
+Json_document_ptr Json_document::parse(Json &js, const std::string &json_str,
+                                       Json_state *state)
+{
+    Json_value root;
+    Json_state ret_state = js.parse(&root, json_str);
+    if (state != nullptr)
+        *state = ret_state;
+    return ret_state == Json_state::OK ? make(&root) : nullptr;
+}
+
+Json_node_ptr Json_document::retain(const Json_value *pv) const
+{
+    return Json_node_ptr(shared_from_this(), pv);
+}
+
+// shallow copy of a member whose storage stays with its document
+static void borrow_member(Json_member *dst, const Json_member *src)
+{
+    memcpy((void*)dst, src, sizeof(Json_member));
+    dst->kflags |= JSON_KEY_BORROWED;
+    dst->val.flags |= JSON_BORROWED;
+}
+
+// merges patch into base, writing the result to the null value out.
+// members the patch leaves alone are borrowed from base, returns
+// whether any were.
+static bool merge_shared(Json_value *out, const Json_value *base,
+                         const Json_value *patch)
+{
+    if (patch->type != Json_type::JSON_OBJECT) {
+        out->copy(patch);
+        return false;
+    }
+    if (base->type != Json_type::JSON_OBJECT) {
+        apply_merge_patch(out, patch);
+        return false;
+    }
+
+    // the members of base that stay, then those the patch adds
+    size_t size = 0;
+    for (size_t i = 0; i < base->obj.size; ++i) {
+        const Json_value *pv = patch->find(KEY_ARG(base->obj.mem[i]));
+        if (pv == nullptr || pv->type != Json_type::JSON_NULL)
+            size++;
+    }
+    for (size_t i = 0; i < patch->obj.size; ++i) {
+        const Json_member &pm = patch->obj.mem[i];
+        if (pm.val.type != Json_type::JSON_NULL &&
+            patch->find(KEY_ARG(pm)) == &pm.val && base->find(KEY_ARG(pm)) == nullptr)
+            size++;
+    }
+
+    out->set_object(size);
+    if (size == 0)
+        return false;
+
+    bool borrowed = false;
+    size_t n = 0;
+    for (size_t i = 0; i < base->obj.size; ++i) {
+        const Json_member &m = base->obj.mem[i];
+        const Json_value *pv = patch->find(KEY_ARG(m));
+        if (pv == nullptr) {
+            borrow_member(&out->obj.mem[n++], &m);
+            borrowed = true;
+        } else if (pv->type != Json_type::JSON_NULL) {
+            Json_member &nm = out->obj.mem[n++];
+            nm.set_key(KEY_ARG(m));
+            borrowed |= merge_shared(&nm.val, &m.val, pv);
+        }
+    }
+
+    Json_value none;
+    for (size_t i = 0; i < patch->obj.size; ++i) {
+        const Json_member &pm = patch->obj.mem[i];
+        if (pm.val.type != Json_type::JSON_NULL &&
+            patch->find(KEY_ARG(pm)) == &pm.val && base->find(KEY_ARG(pm)) == nullptr) {
+            Json_member &nm = out->obj.mem[n++];
+            nm.set_key(KEY_ARG(pm));
+            merge_shared(&nm.val, &none, &pm.val);
+        }
+    }
+    return borrowed;
+}
+
+Json_document_ptr Json_document::derive(const Json_value *merge_patch) const
+{
+    std::shared_ptr<Json_document> doc(new Json_document);
+    if (!merge_shared(&doc->root_, &root_, merge_patch))
+        return doc;
+    if (chain_ >= JSON_DOCUMENT_MAX_CHAIN) {
+        // doc borrows from this, which is alive for the copy
+        return doc->flatten();
+    }
+    doc->base_ = shared_from_this();
+    doc->chain_ = chain_ + 1;
+    return doc;
+}
+
+Json_document_ptr Json_document::flatten() const
+{
+    std::shared_ptr<Json_document> doc(new Json_document);
+    doc->root_.copy(&root_);
+    return doc;
+}
+
+Json_document_ptr Json_document_slot::load() const
+{
+    return std::atomic_load(&doc_);
+}
+
+void Json_document_slot::store(Json_document_ptr doc)
+{
+    std::atomic_store(&doc_, doc);
+}
+
+Json_document_ptr Json_document_slot::update(const Json_value *merge_patch)
+{
+    Json_document_ptr cur = load(), next;
+    do {
+        if (cur != nullptr) {
+            next = cur->derive(merge_patch);
+        } else {
+            Json_value root;
+            apply_merge_patch(&root, merge_patch);
+            next = Json_document::make(&root);
+        }
+    } while (!std::atomic_compare_exchange_weak(&doc_, &cur, next));
+    return next;
+}
+
+} // end namespace JsonParser
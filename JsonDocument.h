@@ -0,0 +1,90 @@
+#ifndef __JSONPARSER_JSONDOCUMENT_H_
+#define __JSONPARSER_JSONDOCUMENT_H_
+
+#include "Json.h"
+
+#include <memory>
+#include <string>
+
+namespace JsonParser
+{
+
+class Json_document;
+typedef std::shared_ptr<const Json_document> Json_document_ptr;
+// a value inside a Json_document, keeping the whole document alive
+typedef std::shared_ptr<const Json_value> Json_node_ptr;
+
+// Immutable document for sharing between threads. The tree is never
+// modified once built, so any number of threads may read it without
+// locking, and its lifetime is that of the last Json_document_ptr or
+// Json_node_ptr referring to it (an atomic reference count).
+//
+// Modified versions are derived copy-on-write: only the values on the
+// path to a change are copied, every other subtree is borrowed from the
+// base document (JSON_BORROWED), which the derived one keeps alive.
+class Json_document : public std::enable_shared_from_this<Json_document>
+{
+public:
+    ~Json_document();
+
+    Json_document(const Json_document&) = delete;
+    Json_document& operator=(const Json_document&) = delete;
+
+    // takes over the contents of root, leaving it null
+    static Json_document_ptr make(Json_value *root);
+    // nullptr if json_str does not parse, the reason is put in state
+    static Json_document_ptr parse(Json &js, const std::string &json_str,
+                                   Json_state *state = nullptr);
+
+    const Json_value* root() const { return &root_; }
+
+    // handle to pv, a value of this document, costing one atomic
+    // increment instead of a copy
+    Json_node_ptr retain(const Json_value *pv) const;
+    Json_node_ptr retain_root() const { return retain(&root_); }
+
+    // a new version with the JSON Merge Patch (RFC 7386) merge_patch
+    // applied. costs the size of the patch plus the width of the
+    // objects it descends through, untouched members are shared.
+    // a version keeps its bases alive, so after JSON_DOCUMENT_MAX_CHAIN
+    // derivations in a row the result is flattened instead, letting
+    // the older versions go.
+    Json_document_ptr derive(const Json_value *merge_patch) const;
+
+    // deep copy that no longer depends on the documents it was derived
+    // from, letting them go
+    Json_document_ptr flatten() const;
+
+private:
+    Json_document() : chain_(0) {}
+
+    Json_document_ptr base_;  // owner of the borrowed values
+    size_t            chain_; // length of the base_ chain
+    Json_value        root_;
+};
+
+// The current version of a shared document. Readers load() it from any
+// thread, writers publish a new version with a pointer swap; readers
+// still holding the old version keep it alive until they drop it.
+class Json_document_slot
+{
+public:
+    explicit Json_document_slot(Json_document_ptr doc = nullptr) : doc_(doc) {}
+
+    Json_document_slot(const Json_document_slot&) = delete;
+    Json_document_slot& operator=(const Json_document_slot&) = delete;
+
+    Json_document_ptr load() const;
+    void store(Json_document_ptr doc);
+
+    // derives the current version with merge_patch and publishes it,
+    // retrying if another writer got in first. returns what was stored.
+    Json_document_ptr update(const Json_value *merge_patch);
+
+private:
+    Json_document_ptr doc_; // only accessed through std::atomic_*
+};
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONDOCUMENT_H_
@@ -0,0 +1,521 @@
+#include "JsonPatch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#define STR_ARG(s) s, sizeof(s) - 1
+#define KEY_ARG(m) (m).get_key(), (m).get_key_length()
+
+namespace JsonParser
+{
+
+// key -> member position of an object, hashed once the object is big
+// enough for a linear scan to lose
+class Member_index
+{
+public:
+    static const size_t npos = (size_t)-1;
+
+    explicit Member_index(const Json_value *obj);
+    size_t find(const char *key, size_t klen) const;
+
+private:
+    const Json_value   *obj_;
+    std::vector<size_t> slots_;
+};
+
+const size_t Member_index::npos;
+
+static const size_t MEMBER_INDEX_MIN_SIZE = 8;
+
+Member_index::Member_index(const Json_value *obj) : obj_(obj)
+{
+    assert(obj->type == Json_type::JSON_OBJECT);
+    if (obj->obj.size <= MEMBER_INDEX_MIN_SIZE)
+        return;
+
+    size_t capacity = 16;
+    while (capacity < obj->obj.size * 2)
+        capacity <<= 1;
+    slots_.assign(capacity, npos);
+
+    // insert backwards so the first of duplicate keys wins
+    for (size_t i = obj->obj.size; i-- > 0; ) {
+        const Json_member &m = obj->obj.mem[i];
+        size_t pos = Json_symbol_table::hash(KEY_ARG(m)) & (capacity - 1);
+        while (slots_[pos] != npos) {
+            const Json_member &other = obj->obj.mem[slots_[pos]];
+            if (other.get_key_length() == m.get_key_length() &&
+                memcmp(other.get_key(), m.get_key(), m.get_key_length()) == 0)
+                break;
+            pos = (pos + 1) & (capacity - 1);
+        }
+        slots_[pos] = i;
+    }
+}
+
+size_t Member_index::find(const char *key, size_t klen) const
+{
+    const Json_member *mem = obj_->obj.mem;
+
+    if (slots_.empty()) {
+        for (size_t i = 0; i < obj_->obj.size; ++i) {
+            if (mem[i].get_key_length() == klen &&
+                memcmp(mem[i].get_key(), key, klen) == 0)
+                return i;
+        }
+        return npos;
+    }
+
+    size_t mask = slots_.size() - 1;
+    for (size_t pos = Json_symbol_table::hash(key, klen) & mask; slots_[pos] != npos;
+         pos = (pos + 1) & mask) {
+        const Json_member &m = mem[slots_[pos]];
+        if (m.get_key_length() == klen && memcmp(m.get_key(), key, klen) == 0)
+            return slots_[pos];
+    }
+    return npos;
+}
+
+// ---------------------------------------------------------------- diff
+
+enum Patch_op_code { OP_ADD, OP_REMOVE, OP_REPLACE };
+
+struct Patch_op {
+    Patch_op_code     code;
+    std::string       path;
+    const Json_value *value;
+};
+
+struct Diff {
+    std::vector<Patch_op>  ops;
+    std::deque<Json_value> unpacked; // packed arrays, alive until ops are built
+};
+
+static void append_token(std::string &path, const char *token, size_t len)
+{
+    path.push_back('/');
+    for (size_t i = 0; i < len; ++i) {
+        if      (token[i] == '~') path.append("~0");
+        else if (token[i] == '/') path.append("~1");
+        else                      path.push_back(token[i]);
+    }
+}
+
+static void append_index(std::string &path, size_t index)
+{
+    std::string token = std::to_string(index);
+    append_token(path, token.data(), token.size());
+}
+
+static void diff_value(Diff &diff, std::string &path,
+                       const Json_value *from, const Json_value *to);
+
+static void diff_object(Diff &diff, std::string &path,
+                        const Json_value *from, const Json_value *to)
+{
+    Member_index to_index(to);
+    std::vector<bool> matched(to->obj.size, false);
+    size_t path_len = path.size();
+
+    for (size_t i = 0; i < from->obj.size; ++i) {
+        const Json_member &m = from->obj.mem[i];
+        size_t j = to_index.find(KEY_ARG(m));
+
+        append_token(path, KEY_ARG(m));
+        if (j == Member_index::npos) {
+            diff.ops.push_back(Patch_op{ OP_REMOVE, path, nullptr });
+        } else {
+            matched[j] = true;
+            diff_value(diff, path, &m.val, &to->obj.mem[j].val);
+        }
+        path.resize(path_len);
+    }
+
+    for (size_t j = 0; j < to->obj.size; ++j) {
+        if (matched[j])
+            continue;
+        const Json_member &m = to->obj.mem[j];
+        append_token(path, KEY_ARG(m));
+        diff.ops.push_back(Patch_op{ OP_ADD, path, &m.val });
+        path.resize(path_len);
+    }
+}
+
+static const Json_value* unpacked(Diff &diff, const Json_value *pv)
+{
+    if (!pv->is_packed())
+        return pv;
+    diff.unpacked.emplace_back();
+    diff.unpacked.back().copy(pv);
+    diff.unpacked.back().unpack();
+    return &diff.unpacked.back();
+}
+
+static void diff_array(Diff &diff, std::string &path,
+                       const Json_value *from, const Json_value *to)
+{
+    from = unpacked(diff, from);
+    to = unpacked(diff, to);
+
+    const Json_value *fe = from->arr.elem, *te = to->arr.elem;
+    size_t n = from->arr.size, m = to->arr.size;
+    size_t head = 0, tail = 0;
+    size_t path_len = path.size();
+
+    // unchanged head and tail
+    while (head < n && head < m && fe[head].equals(&te[head]))
+        head++;
+    while (tail < n - head && tail < m - head &&
+           fe[n - 1 - tail].equals(&te[m - 1 - tail]))
+        tail++;
+
+    // what is left is compared by position
+    size_t fn = n - head - tail, tn = m - head - tail;
+    size_t common = fn < tn ? fn : tn;
+
+    for (size_t k = 0; k < common; ++k) {
+        append_index(path, head + k);
+        diff_value(diff, path, &fe[head + k], &te[head + k]);
+        path.resize(path_len);
+    }
+    for (size_t k = common; k < fn; ++k) {
+        append_index(path, head + common);
+        diff.ops.push_back(Patch_op{ OP_REMOVE, path, nullptr });
+        path.resize(path_len);
+    }
+    for (size_t k = common; k < tn; ++k) {
+        append_index(path, head + k);
+        diff.ops.push_back(Patch_op{ OP_ADD, path, &te[head + k] });
+        path.resize(path_len);
+    }
+}
+
+static void diff_value(Diff &diff, std::string &path,
+                       const Json_value *from, const Json_value *to)
+{
+    if (from->type == to->type) {
+        if (from->type == Json_type::JSON_OBJECT) {
+            diff_object(diff, path, from, to);
+            return;
+        }
+        if (from->type == Json_type::JSON_ARRAY) {
+            diff_array(diff, path, from, to);
+            return;
+        }
+        if (from->equals(to))
+            return;
+    }
+    diff.ops.push_back(Patch_op{ OP_REPLACE, path, to });
+}
+
+void make_patch(Json_value *patch, const Json_value *from, const Json_value *to)
+{
+    static const char *op_names[] = { "add", "remove", "replace" };
+
+    Diff diff;
+    std::string path;
+    diff_value(diff, path, from, to);
+
+    const std::vector<Patch_op> &ops = diff.ops;
+    patch->set_array(ops.size());
+    for (size_t i = 0; i < ops.size(); ++i) {
+        Json_value &op = patch->arr.elem[i];
+        const char *name = op_names[ops[i].code];
+
+        op.set_object();
+        op.set_member(STR_ARG("op"))->set_string(name, strlen(name));
+        op.set_member(STR_ARG("path"))->set_string(ops[i].path.data(),
+                                                   ops[i].path.size());
+        if (ops[i].value != nullptr)
+            op.set_member(STR_ARG("value"))->copy(ops[i].value);
+    }
+}
+
+// --------------------------------------------------------------- apply
+
+typedef std::vector<std::string> Pointer;
+
+// splits a JSON Pointer (RFC 6901) into unescaped reference tokens
+static bool parse_pointer(Pointer &tokens, const Json_value *pv)
+{
+    if (pv == nullptr || pv->type != Json_type::JSON_STRING)
+        return false;
+
+    const char *p = pv->get_string(), *end = p + pv->get_string_length();
+    tokens.clear();
+    if (p == end)
+        return true; // whole document
+    if (*p != '/')
+        return false;
+
+    while (p < end) {
+        std::string token;
+        for (++p; p < end && *p != '/'; ++p) {
+            if (*p != '~') {
+                token.push_back(*p);
+                continue;
+            }
+            if (++p == end)
+                return false;
+            if      (*p == '0') token.push_back('~');
+            else if (*p == '1') token.push_back('/');
+            else return false;
+        }
+        tokens.push_back(token);
+    }
+    return true;
+}
+
+static bool parse_index(const std::string &token, size_t &index)
+{
+    if (token.empty() || (token[0] == '0' && token.size() > 1))
+        return false;
+
+    index = 0;
+    for (char ch : token) {
+        if (ch < '0' || ch > '9')
+            return false;
+        index = index * 10 + (ch - '0');
+    }
+    return true;
+}
+
+// the value referenced by the first count tokens, nullptr if absent.
+// packed arrays on the way are unpacked so their elements can be used.
+static Json_value* resolve(Json_value *doc, const Pointer &tokens, size_t count)
+{
+    Json_value *pv = doc;
+    size_t index;
+
+    for (size_t i = 0; i < count && pv != nullptr; ++i) {
+        const std::string &token = tokens[i];
+        pv->unpack();
+        if (pv->type == Json_type::JSON_OBJECT) {
+            pv = pv->find(token.data(), token.size());
+        } else if (pv->type == Json_type::JSON_ARRAY &&
+                   parse_index(token, index) && index < pv->arr.size) {
+            pv = &pv->arr.elem[index];
+        } else {
+            pv = nullptr;
+        }
+    }
+    return pv;
+}
+
+// moves val to the location tokens refer to
+static Json_state add_value(Json_value *doc, const Pointer &tokens, Json_value *val)
+{
+    if (tokens.empty()) {
+        doc->move(val);
+        return Json_state::OK;
+    }
+
+    Json_value *parent = resolve(doc, tokens, tokens.size() - 1);
+    const std::string &last = tokens.back();
+    size_t index;
+
+    if (parent == nullptr)
+        return Json_state::PATCH_PATH_NOT_FOUND;
+    if (parent->type == Json_type::JSON_OBJECT) {
+        parent->set_member(last.data(), last.size())->move(val);
+        return Json_state::OK;
+    }
+    if (parent->type == Json_type::JSON_ARRAY) {
+        if (last == "-")
+            index = parent->arr.size;
+        else if (!parse_index(last, index) || index > parent->arr.size)
+            return Json_state::PATCH_PATH_NOT_FOUND;
+        parent->insert_element(index)->move(val);
+        return Json_state::OK;
+    }
+    return Json_state::PATCH_PATH_NOT_FOUND;
+}
+
+// removes the value tokens refer to, moving it to out if given
+static Json_state remove_value(Json_value *doc, const Pointer &tokens, Json_value *out)
+{
+    if (tokens.empty()) {
+        if (out != nullptr)
+            out->move(doc);
+        doc->set_null();
+        return Json_state::OK;
+    }
+
+    Json_value *parent = resolve(doc, tokens, tokens.size() - 1);
+    const std::string &last = tokens.back();
+    size_t index;
+
+    if (parent == nullptr)
+        return Json_state::PATCH_PATH_NOT_FOUND;
+    parent->unpack();
+    if (parent->type == Json_type::JSON_OBJECT) {
+        Json_value *pv = parent->find(last.data(), last.size());
+        if (pv == nullptr)
+            return Json_state::PATCH_PATH_NOT_FOUND;
+        if (out != nullptr)
+            out->move(pv);
+        parent->erase_member(last.data(), last.size());
+        return Json_state::OK;
+    }
+    if (parent->type == Json_type::JSON_ARRAY &&
+        parse_index(last, index) && index < parent->arr.size) {
+        if (out != nullptr)
+            out->move(&parent->arr.elem[index]);
+        parent->erase_element(index);
+        return Json_state::OK;
+    }
+    return Json_state::PATCH_PATH_NOT_FOUND;
+}
+
+static bool op_is(const Json_value *name, const char *s)
+{
+    size_t len = name->get_string_length();
+    return len == strlen(s) && memcmp(name->get_string(), s, len) == 0;
+}
+
+static Json_state apply_operation(Json_value *doc, const Json_value *op)
+{
+    if (op->type != Json_type::JSON_OBJECT)
+        return Json_state::INVALID_PATCH;
+
+    const Json_value *name  = op->find(STR_ARG("op"));
+    const Json_value *value = op->find(STR_ARG("value"));
+    Pointer path, from;
+    Json_value tmp;
+
+    if (name == nullptr || name->type != Json_type::JSON_STRING ||
+        !parse_pointer(path, op->find(STR_ARG("path"))))
+        return Json_state::INVALID_PATCH;
+
+    if (op_is(name, "add")) {
+        if (value == nullptr)
+            return Json_state::INVALID_PATCH;
+        tmp.copy(value);
+        return add_value(doc, path, &tmp);
+    }
+    if (op_is(name, "remove"))
+        return remove_value(doc, path, nullptr);
+    if (op_is(name, "replace")) {
+        if (value == nullptr)
+            return Json_state::INVALID_PATCH;
+        Json_value *target = resolve(doc, path, path.size());
+        if (target == nullptr)
+            return Json_state::PATCH_PATH_NOT_FOUND;
+        tmp.copy(value);
+        target->move(&tmp);
+        return Json_state::OK;
+    }
+    if (op_is(name, "test")) {
+        if (value == nullptr)
+            return Json_state::INVALID_PATCH;
+        Json_value *target = resolve(doc, path, path.size());
+        if (target == nullptr)
+            return Json_state::PATCH_PATH_NOT_FOUND;
+        return target->equals(value) ? Json_state::OK
+                                           : Json_state::PATCH_TEST_FAILED;
+    }
+
+    if (!parse_pointer(from, op->find(STR_ARG("from"))))
+        return Json_state::INVALID_PATCH;
+
+    if (op_is(name, "move")) {
+        // a value cannot be moved into one of its own children
+        if (from.size() < path.size() &&
+            std::equal(from.begin(), from.end(), path.begin()))
+            return Json_state::INVALID_PATCH;
+        Json_state state = remove_value(doc, from, &tmp);
+        if (state != Json_state::OK)
+            return state;
+        state = add_value(doc, path, &tmp);
+        if (state != Json_state::OK)
+            add_value(doc, from, &tmp); // put it back, it was just there
+        return state;
+    }
+    if (op_is(name, "copy")) {
+        Json_value *source = resolve(doc, from, from.size());
+        if (source == nullptr)
+            return Json_state::PATCH_PATH_NOT_FOUND;
+        tmp.copy(source);
+        return add_value(doc, path, &tmp);
+    }
+    return Json_state::INVALID_PATCH;
+}
+
+Json_state apply_patch(Json_value *doc, const Json_value *patch)
+{
+    if (patch->type != Json_type::JSON_ARRAY)
+        return Json_state::INVALID_PATCH;
+
+    for (size_t i = 0; i < patch->arr.size; ++i) {
+        Json_state state = apply_operation(doc, &patch->arr.elem[i]);
+        if (state != Json_state::OK)
+            return state;
+    }
+    return Json_state::OK;
+}
+
+// ---------------------------------------------------------- merge patch
+
+void make_merge_patch(Json_value *patch, const Json_value *from, const Json_value *to)
+{
+    if (from->type != Json_type::JSON_OBJECT || to->type != Json_type::JSON_OBJECT) {
+        patch->copy(to);
+        return;
+    }
+
+    Member_index from_index(from), to_index(to);
+    patch->set_object();
+
+    for (size_t i = 0; i < from->obj.size; ++i) {
+        const Json_member &m = from->obj.mem[i];
+        if (to_index.find(KEY_ARG(m)) == Member_index::npos)
+            patch->set_member(KEY_ARG(m))->set_null();
+    }
+
+    for (size_t j = 0; j < to->obj.size; ++j) {
+        const Json_member &m = to->obj.mem[j];
+        size_t i = from_index.find(KEY_ARG(m));
+
+        if (i == Member_index::npos) {
+            patch->set_member(KEY_ARG(m))->copy(&m.val);
+            continue;
+        }
+
+        const Json_value *fv = &from->obj.mem[i].val;
+        if (fv->type == Json_type::JSON_OBJECT && m.val.type == Json_type::JSON_OBJECT) {
+            Json_value sub;
+            make_merge_patch(&sub, fv, &m.val);
+            if (sub.obj.size > 0)
+                patch->set_member(KEY_ARG(m))->move(&sub);
+        } else if (!fv->equals(&m.val)) {
+            patch->set_member(KEY_ARG(m))->copy(&m.val);
+        }
+    }
+}
+
+void apply_merge_patch(Json_value *doc, const Json_value *patch)
+{
+    if (patch->type != Json_type::JSON_OBJECT) {
+        doc->copy(patch);
+        return;
+    }
+
+    if (doc->type != Json_type::JSON_OBJECT)
+        doc->set_object();
+
+    for (size_t i = 0; i < patch->obj.size; ++i) {
+        const Json_member &m = patch->obj.mem[i];
+        if (m.val.type == Json_type::JSON_NULL)
+            doc->erase_member(KEY_ARG(m));
+        else
+            apply_merge_patch(doc->set_member(KEY_ARG(m)), &m.val);
+    }
+}
+
+} // end namespace JsonParser
@@ -0,0 +1,25 @@
+#ifndef __JSONPARSER_JSONPATCH_H_
+#define __JSONPARSER_JSONPATCH_H_
+
+#include "Json.h"
+
+namespace JsonParser
+{
+
+// JSON Patch (RFC 6902): makes patch an array of operations turning
+// from into to. objects are matched by key, arrays by trimming the
+// common head and tail and comparing what is left by position.
+void make_patch(Json_value *patch, const Json_value *from, const Json_value *to);
+
+// applies a JSON Patch to doc in place. operations are applied in
+// order and processing stops at the first failing one, leaving the
+// operations before it applied.
+Json_state apply_patch(Json_value *doc, const Json_value *patch);
+
+// JSON Merge Patch (RFC 7386)
+void make_merge_patch(Json_value *patch, const Json_value *from, const Json_value *to);
+void apply_merge_patch(Json_value *doc, const Json_value *patch);
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONPATCH_H_
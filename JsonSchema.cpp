@@ -0,0 +1,502 @@
+#include "JsonSchema.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <regex>
+
+#define STR_ARG(s) s, sizeof(s) - 1
+#define KEY_ARG(m) (m).get_key(), (m).get_key_length()
+
+namespace JsonParser
+{
+
+// type keyword bits, one per Json_type plus integer
+#define TYPE_BIT(t)  (1u << (t))
+#define TYPE_INTEGER (1u << 7)
+
+struct Json_schema_property {
+    std::string key;
+    const Json_schema_node *node; // nullptr when only required
+    size_t required;              // position among the required, or npos
+};
+
+struct Json_schema_node {
+    static const size_t npos = (size_t)-1;
+
+    Json_schema_node()
+        : reject(false), types(0),
+          minimum(-HUGE_VAL), maximum(HUGE_VAL),
+          exclusive_minimum(false), exclusive_maximum(false),
+          min_length(0), max_length(npos), min_items(0), max_items(npos),
+          min_properties(0), max_properties(npos), constant_hash(0),
+          has_constant(false), required(0), items(nullptr)
+    {
+    }
+
+    bool     reject;  // the false schema
+    unsigned types;   // TYPE_* bits, 0 for any type
+    double   minimum, maximum;
+    bool     exclusive_minimum, exclusive_maximum;
+    size_t   min_length, max_length;
+    size_t   min_items, max_items;
+    size_t   min_properties, max_properties;
+
+    std::deque<Json_value>      enums;
+    std::vector<uint64_t>       enum_hashes;
+    Json_value                  constant;
+    uint64_t                    constant_hash;
+    bool                        has_constant;
+    std::unique_ptr<std::regex> pattern;
+
+    // properties and required keys, sorted by key
+    std::vector<Json_schema_property> props;
+    size_t                            required;
+    const Json_schema_node           *items;
+};
+
+const size_t Json_schema_node::npos;
+
+Json_schema::Json_schema()
+    : root_(nullptr)
+{
+}
+
+Json_schema::~Json_schema()
+{
+}
+
+// ------------------------------------------------------------ compiling
+
+static bool key_is(const Json_member &m, const char *s, size_t len)
+{
+    return m.get_key_length() == len && memcmp(m.get_key(), s, len) == 0;
+}
+
+static bool string_is(const Json_value *pv, const char *s, size_t len)
+{
+    return pv->get_string_length() == len && memcmp(pv->get_string(), s, len) == 0;
+}
+
+static bool get_count(const Json_value *pv, size_t &count)
+{
+    if (pv->type != Json_type::JSON_NUMBER || pv->number < 0 ||
+        pv->number != std::floor(pv->number))
+        return false;
+    count = pv->number < 1e18 ? (size_t)pv->number : Json_schema_node::npos;
+    return true;
+}
+
+static bool get_type(const Json_value *pv, unsigned &types)
+{
+    if (pv->type != Json_type::JSON_STRING)
+        return false;
+    if      (string_is(pv, STR_ARG("null")))    types |= TYPE_BIT(Json_type::JSON_NULL);
+    else if (string_is(pv, STR_ARG("boolean"))) types |= TYPE_BIT(Json_type::JSON_FALSE) |
+                                                         TYPE_BIT(Json_type::JSON_TRUE);
+    else if (string_is(pv, STR_ARG("number")))  types |= TYPE_BIT(Json_type::JSON_NUMBER);
+    else if (string_is(pv, STR_ARG("integer"))) types |= TYPE_INTEGER;
+    else if (string_is(pv, STR_ARG("string")))  types |= TYPE_BIT(Json_type::JSON_STRING);
+    else if (string_is(pv, STR_ARG("array")))   types |= TYPE_BIT(Json_type::JSON_ARRAY);
+    else if (string_is(pv, STR_ARG("object")))  types |= TYPE_BIT(Json_type::JSON_OBJECT);
+    else return false;
+    return true;
+}
+
+static void add_enum(Json_schema_node *node, const Json_value *pv)
+{
+    node->enums.emplace_back();
+    node->enums.back().copy(pv);
+    node->enum_hashes.push_back(pv->hash());
+}
+
+static bool property_less(const Json_schema_property &a, const Json_schema_property &b)
+{
+    return a.key < b.key;
+}
+
+static Json_schema_property* find_property(std::vector<Json_schema_property> &props,
+                                           const char *key, size_t klen)
+{
+    for (size_t i = 0; i < props.size(); ++i) {
+        if (props[i].key.size() == klen && memcmp(props[i].key.data(), key, klen) == 0)
+            return &props[i];
+    }
+    return nullptr;
+}
+
+Json_schema_node* Json_schema::compile_node(const Json_value *schema)
+{
+    nodes_.emplace_back(new Json_schema_node);
+    Json_schema_node *node = nodes_.back().get();
+
+    if (schema->type == Json_type::JSON_TRUE)
+        return node;
+    if (schema->type == Json_type::JSON_FALSE) {
+        node->reject = true;
+        return node;
+    }
+    if (schema->type != Json_type::JSON_OBJECT)
+        return nullptr;
+
+    std::vector<Json_schema_property> &props = node->props;
+    for (size_t i = 0; i < schema->obj.size; ++i) {
+        const Json_member &m = schema->obj.mem[i];
+        const Json_value *pv = &m.val;
+        bool ok = true;
+
+        if (key_is(m, STR_ARG("type"))) {
+            if (pv->type == Json_type::JSON_ARRAY) {
+                Json_value tmp;
+                tmp.copy(pv);
+                tmp.unpack();
+                for (size_t j = 0; j < tmp.arr.size && ok; ++j)
+                    ok = get_type(&tmp.arr.elem[j], node->types);
+            } else {
+                ok = get_type(pv, node->types);
+            }
+        } else if (key_is(m, STR_ARG("enum"))) {
+            ok = pv->type == Json_type::JSON_ARRAY;
+            if (ok) {
+                Json_value tmp;
+                tmp.copy(pv);
+                tmp.unpack();
+                for (size_t j = 0; j < tmp.arr.size; ++j)
+                    add_enum(node, &tmp.arr.elem[j]);
+                // an empty enum matches nothing
+                node->reject = node->reject || tmp.arr.size == 0;
+            }
+        } else if (key_is(m, STR_ARG("const"))) {
+            node->constant.copy(pv);
+            node->constant_hash = pv->hash();
+            node->has_constant = true;
+        } else if (key_is(m, STR_ARG("minimum"))) {
+            // with exclusiveMinimum as well the stricter bound wins
+            ok = pv->type == Json_type::JSON_NUMBER;
+            if (ok && pv->number > node->minimum) {
+                node->minimum = pv->number;
+                node->exclusive_minimum = false;
+            }
+        } else if (key_is(m, STR_ARG("exclusiveMinimum"))) {
+            ok = pv->type == Json_type::JSON_NUMBER;
+            if (ok && pv->number >= node->minimum) {
+                node->minimum = pv->number;
+                node->exclusive_minimum = true;
+            }
+        } else if (key_is(m, STR_ARG("maximum"))) {
+            ok = pv->type == Json_type::JSON_NUMBER;
+            if (ok && pv->number < node->maximum) {
+                node->maximum = pv->number;
+                node->exclusive_maximum = false;
+            }
+        } else if (key_is(m, STR_ARG("exclusiveMaximum"))) {
+            ok = pv->type == Json_type::JSON_NUMBER;
+            if (ok && pv->number <= node->maximum) {
+                node->maximum = pv->number;
+                node->exclusive_maximum = true;
+            }
+        } else if (key_is(m, STR_ARG("minLength"))) {
+            ok = get_count(pv, node->min_length);
+        } else if (key_is(m, STR_ARG("maxLength"))) {
+            ok = get_count(pv, node->max_length);
+        } else if (key_is(m, STR_ARG("minItems"))) {
+            ok = get_count(pv, node->min_items);
+        } else if (key_is(m, STR_ARG("maxItems"))) {
+            ok = get_count(pv, node->max_items);
+        } else if (key_is(m, STR_ARG("minProperties"))) {
+            ok = get_count(pv, node->min_properties);
+        } else if (key_is(m, STR_ARG("maxProperties"))) {
+            ok = get_count(pv, node->max_properties);
+        } else if (key_is(m, STR_ARG("pattern"))) {
+            ok = pv->type == Json_type::JSON_STRING;
+            if (ok) {
+                try {
+                    node->pattern.reset(new std::regex(pv->get_string(),
+                                                       pv->get_string_length(),
+                                                       std::regex::ECMAScript));
+                } catch (const std::regex_error&) {
+                    ok = false;
+                }
+            }
+        } else if (key_is(m, STR_ARG("properties"))) {
+            ok = pv->type == Json_type::JSON_OBJECT;
+            for (size_t j = 0; ok && j < pv->obj.size; ++j) {
+                const Json_member &pm = pv->obj.mem[j];
+                const Json_schema_node *child = compile_node(&pm.val);
+                Json_schema_property *prop = find_property(props, KEY_ARG(pm));
+                if (prop == nullptr) {
+                    props.push_back(Json_schema_property{
+                        std::string(KEY_ARG(pm)), nullptr, Json_schema_node::npos });
+                    prop = &props.back();
+                }
+                prop->node = child;
+                ok = child != nullptr;
+            }
+        } else if (key_is(m, STR_ARG("required"))) {
+            ok = pv->type == Json_type::JSON_ARRAY && !pv->is_packed();
+            for (size_t j = 0; ok && j < pv->arr.size; ++j) {
+                const Json_value *key = &pv->arr.elem[j];
+                ok = key->type == Json_type::JSON_STRING;
+                if (!ok)
+                    break;
+                const char *k = key->get_string();
+                size_t klen = key->get_string_length();
+                Json_schema_property *prop = find_property(props, k, klen);
+                if (prop == nullptr) {
+                    props.push_back(Json_schema_property{
+                        std::string(k, klen), nullptr, Json_schema_node::npos });
+                    prop = &props.back();
+                }
+                if (prop->required == Json_schema_node::npos)
+                    prop->required = node->required++;
+            }
+        } else if (key_is(m, STR_ARG("items"))) {
+            node->items = compile_node(pv);
+            ok = node->items != nullptr;
+        } else if (!(key_is(m, STR_ARG("$schema")) || key_is(m, STR_ARG("$id")) ||
+                     key_is(m, STR_ARG("$comment")) || key_is(m, STR_ARG("$defs")) ||
+                     key_is(m, STR_ARG("title")) || key_is(m, STR_ARG("description")) ||
+                     key_is(m, STR_ARG("default")) || key_is(m, STR_ARG("examples")) ||
+                     key_is(m, STR_ARG("deprecated")) || key_is(m, STR_ARG("readOnly")) ||
+                     key_is(m, STR_ARG("writeOnly")))) {
+            // an applicator or assertion we do not implement; accepting
+            // it silently would let invalid documents through
+            ok = false;
+        }
+        if (!ok)
+            return nullptr;
+    }
+    std::sort(props.begin(), props.end(), property_less);
+    return node;
+}
+
+Json_state Json_schema::compile(const Json_value *schema)
+{
+    nodes_.clear();
+    root_ = compile_node(schema);
+    if (root_ == nullptr) {
+        nodes_.clear();
+        return Json_state::INVALID_SCHEMA;
+    }
+    return Json_state::OK;
+}
+
+// ----------------------------------------------------------- validating
+
+const Json_schema_node* Json_schema::root() const
+{
+    return root_;
+}
+
+const Json_schema_node* Json_schema::item(const Json_schema_node *node)
+{
+    return node != nullptr ? node->items : nullptr;
+}
+
+static const Json_schema_property* lookup_property(const Json_schema_node *node,
+                                                   const char *key, size_t klen)
+{
+    size_t lo = 0, hi = node->props.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const std::string &k = node->props[mid].key;
+        int cmp = memcmp(k.data(), key, std::min(k.size(), klen));
+        if (cmp == 0)
+            cmp = k.size() < klen ? -1 : k.size() > klen ? 1 : 0;
+        if (cmp == 0)
+            return &node->props[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return nullptr;
+}
+
+const Json_schema_node* Json_schema::property(const Json_schema_node *node,
+                                              const char *key, size_t klen)
+{
+    if (node == nullptr || node->props.empty())
+        return nullptr;
+    const Json_schema_property *prop = lookup_property(node, key, klen);
+    return prop != nullptr ? prop->node : nullptr;
+}
+
+bool Json_schema::accepts_type(const Json_schema_node *node, Json_type type)
+{
+    if (node == nullptr)
+        return true;
+    if (node->reject)
+        return false;
+    if (node->types == 0 || (node->types & TYPE_BIT(type)))
+        return true;
+    return type == Json_type::JSON_NUMBER && (node->types & TYPE_INTEGER);
+}
+
+// UTF-8 code points, which is what minLength and maxLength count
+static size_t count_code_points(const char *s, size_t len)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; ++i)
+        count += ((unsigned char)s[i] & 0xC0) != 0x80;
+    return count;
+}
+
+static bool has_required(const Json_schema_node *node, const Json_value *val)
+{
+    // count each required key once, even if duplicated in val
+    std::vector<bool> seen_many;
+    uint64_t seen = 0;
+    size_t found = 0;
+
+    if (node->required > 64)
+        seen_many.resize(node->required);
+    for (size_t i = 0; i < val->obj.size; ++i) {
+        const Json_member &m = val->obj.mem[i];
+        const Json_schema_property *prop = lookup_property(node, KEY_ARG(m));
+        if (prop == nullptr || prop->required == Json_schema_node::npos)
+            continue;
+        if (node->required > 64) {
+            if (seen_many[prop->required])
+                continue;
+            seen_many[prop->required] = true;
+        } else {
+            uint64_t bit = (uint64_t)1 << prop->required;
+            if (seen & bit)
+                continue;
+            seen |= bit;
+        }
+        found++;
+    }
+    return found == node->required;
+}
+
+bool Json_schema::check(const Json_schema_node *node, const Json_value *val)
+{
+    if (node == nullptr)
+        return true;
+    if (!accepts_type(node, val->type))
+        return false;
+
+    switch (val->type) {
+        case Json_type::JSON_NUMBER : {
+            double n = val->number;
+            if (node->types != 0 && !(node->types & TYPE_BIT(Json_type::JSON_NUMBER)) &&
+                n != std::floor(n))
+                return false; // integer only
+            if (node->exclusive_minimum ? n <= node->minimum : n < node->minimum)
+                return false;
+            if (node->exclusive_maximum ? n >= node->maximum : n > node->maximum)
+                return false;
+            break;
+        }
+        case Json_type::JSON_STRING : {
+            const char *s = val->get_string();
+            size_t len = val->get_string_length();
+            if (node->min_length > 0 || node->max_length != Json_schema_node::npos) {
+                // a code point takes 1 to 4 bytes
+                if (len < node->min_length || len / 4 > node->max_length)
+                    return false;
+                size_t count = count_code_points(s, len);
+                if (count < node->min_length || count > node->max_length)
+                    return false;
+            }
+            if (node->pattern && !std::regex_search(s, s + len, *node->pattern))
+                return false;
+            break;
+        }
+        case Json_type::JSON_ARRAY :
+            if (val->arr.size < node->min_items || val->arr.size > node->max_items)
+                return false;
+            break;
+        case Json_type::JSON_OBJECT :
+            if (val->obj.size < node->min_properties || val->obj.size > node->max_properties)
+                return false;
+            if (node->required > 0 && !has_required(node, val))
+                return false;
+            break;
+        default :
+            break;
+    }
+
+    if (node->has_constant || !node->enums.empty()) {
+        uint64_t h = val->hash();
+        if (node->has_constant && !(node->constant_hash == h && node->constant.equals(val)))
+            return false;
+        if (node->enums.empty())
+            return true;
+        for (size_t i = 0; i < node->enums.size(); ++i) {
+            if (node->enum_hashes[i] == h && node->enums[i].equals(val))
+                return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+void Json_schema::prepend_token(std::string &path, const char *token, size_t len)
+{
+    std::string escaped(1, '/');
+    for (size_t i = 0; i < len; ++i) {
+        if      (token[i] == '~') escaped.append("~0");
+        else if (token[i] == '/') escaped.append("~1");
+        else                      escaped.push_back(token[i]);
+    }
+    path.insert(0, escaped);
+}
+
+static void prepend_index(std::string *path, size_t index)
+{
+    if (path != nullptr) {
+        std::string token = std::to_string(index);
+        Json_schema::prepend_token(*path, token.data(), token.size());
+    }
+}
+
+// subschemas first, in the order parsing meets them, then node itself
+static bool validate_value(const Json_schema_node *node, const Json_value *val,
+                           std::string *path)
+{
+    if (node == nullptr)
+        return true;
+    if (!Json_schema::accepts_type(node, val->type))
+        return false;
+
+    if (val->type == Json_type::JSON_ARRAY && node->items != nullptr) {
+        for (size_t i = 0; i < val->arr.size; ++i) {
+            Json_value num;
+            const Json_value *elem = &val->arr.elem[i];
+            if (val->is_packed()) {
+                num.set_number(val->narr.num[i]);
+                elem = &num;
+            }
+            if (!validate_value(node->items, elem, path)) {
+                prepend_index(path, i);
+                return false;
+            }
+        }
+    } else if (val->type == Json_type::JSON_OBJECT && !node->props.empty()) {
+        for (size_t i = 0; i < val->obj.size; ++i) {
+            const Json_member &m = val->obj.mem[i];
+            const Json_schema_node *child = Json_schema::property(node, KEY_ARG(m));
+            if (!validate_value(child, &m.val, path)) {
+                if (path != nullptr)
+                    Json_schema::prepend_token(*path, KEY_ARG(m));
+                return false;
+            }
+        }
+    }
+    return Json_schema::check(node, val);
+}
+
+Json_state Json_schema::validate(const Json_value *val, std::string *path) const
+{
+    if (path != nullptr)
+        path->clear();
+    if (validate_value(root_, val, path))
+        return Json_state::OK;
+    return Json_state::SCHEMA_MISMATCH;
+}
+
+} // end namespace JsonParser
@@ -0,0 +1,61 @@
+#ifndef __JSONPARSER_JSONSCHEMA_H_
+#define __JSONPARSER_JSONSCHEMA_H_
+
+#include "Json.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace JsonParser
+{
+
+// the compiled form of one (sub)schema
+struct Json_schema_node;
+
+// JSON Schema (draft 2020-12) validator for the keywords type, enum,
+// const, required, properties, items, minimum, maximum,
+// exclusiveMinimum, exclusiveMaximum, minLength, maxLength, minItems,
+// maxItems, minProperties, maxProperties and pattern, plus the boolean
+// schemas. The schema is compiled once, after which a tree can be
+// checked with validate(), or Json::set_schema() checks documents as
+// they are parsed, rejecting them at the first offending value.
+class Json_schema
+{
+public:
+    Json_schema();
+    ~Json_schema();
+
+    Json_schema(const Json_schema&) = delete;
+    Json_schema& operator=(const Json_schema&) = delete;
+
+    // INVALID_SCHEMA for malformed schemas and keywords outside the
+    // subset above (annotations like title are ignored)
+    Json_state compile(const Json_value *schema);
+
+    // SCHEMA_MISMATCH if val does not conform, path is then set to the
+    // JSON Pointer of the offending value
+    Json_state validate(const Json_value *val, std::string *path = nullptr) const;
+
+    // hooks for Json::parse. a nullptr node accepts anything.
+    const Json_schema_node* root() const;
+    static const Json_schema_node* item(const Json_schema_node *node);
+    static const Json_schema_node* property(const Json_schema_node *node,
+                                            const char *key, size_t klen);
+    // whether a value of type may match node at all
+    static bool accepts_type(const Json_schema_node *node, Json_type type);
+    // the keywords of node itself, its subschemas are not applied
+    static bool check(const Json_schema_node *node, const Json_value *val);
+    // adds a reference token in front of a JSON Pointer
+    static void prepend_token(std::string &path, const char *token, size_t len);
+
+private:
+    Json_schema_node* compile_node(const Json_value *schema);
+
+    std::vector<std::unique_ptr<Json_schema_node> > nodes_;
+    const Json_schema_node *root_;
+};
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONSCHEMA_H_
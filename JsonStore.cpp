@@ -0,0 +1,310 @@
+#include "JsonStore.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// initial size of a file being built, it doubles from there
+#ifndef JSON_STORE_INIT_SIZE
+#define JSON_STORE_INIT_SIZE (1 << 20)
+#endif
+
+namespace JsonParser
+{
+
+// ------------------------------------------------------------ reading
+
+double Json_store_value::number() const
+{
+    double n;
+    memcpy(&n, &node_->data, sizeof(n));
+    return n;
+}
+
+Json_store_value Json_store_value::element(size_t index) const
+{
+    return Json_store_value(base_, children() + index);
+}
+
+const char* Json_store_value::get_key(size_t index) const
+{
+    return base_ + children()[2 * index].data;
+}
+
+size_t Json_store_value::get_key_length(size_t index) const
+{
+    return (size_t)(children()[2 * index].info >> 3);
+}
+
+Json_store_value Json_store_value::member(size_t index) const
+{
+    return Json_store_value(base_, children() + 2 * index + 1);
+}
+
+Json_store_value Json_store_value::find(const char *key, size_t klen) const
+{
+    if (node_ == nullptr || type() != Json_type::JSON_OBJECT)
+        return Json_store_value();
+    for (size_t i = 0, n = size(); i < n; ++i) {
+        if (get_key_length(i) == klen && memcmp(get_key(i), key, klen) == 0)
+            return member(i);
+    }
+    return Json_store_value();
+}
+
+void Json_store_value::copy_to(Json_value *out) const
+{
+    switch (type()) {
+        case Json_type::JSON_NULL :   out->set_null(); break;
+        case Json_type::JSON_FALSE :  out->set_boolean(false); break;
+        case Json_type::JSON_TRUE :   out->set_boolean(true); break;
+        case Json_type::JSON_NUMBER : out->set_number(number()); break;
+        case Json_type::JSON_STRING :
+            out->set_string(get_string(), get_string_length());
+            break;
+        case Json_type::JSON_ARRAY :
+            out->set_array(size());
+            for (size_t i = 0; i < size(); ++i)
+                element(i).copy_to(&out->arr.elem[i]);
+            break;
+        case Json_type::JSON_OBJECT :
+            // repeated keys are kept, as parse() does
+            out->set_object(size());
+            for (size_t i = 0; i < size(); ++i) {
+                out->obj.mem[i].set_key(get_key(i), get_key_length(i));
+                member(i).copy_to(&out->obj.mem[i].val);
+            }
+            break;
+    }
+}
+
+Json_store::Json_store() : base_(nullptr), size_(0)
+{
+}
+
+Json_store::~Json_store()
+{
+    close();
+}
+
+// files are mapped with POSIX calls, elsewhere nothing opens or
+// grows and Json::parse_store() fails with IO_ERROR
+#ifndef _WINDOWS
+bool Json_store::open(const char *path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(Json_store_header))
+        p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file
+    if (p == MAP_FAILED)
+        return false;
+
+    if (memcmp(p, JSON_STORE_MAGIC, 8) != 0) {
+        munmap(p, st.st_size);
+        return false;
+    }
+    base_ = (const char*)p;
+    size_ = st.st_size;
+    return true;
+}
+
+void Json_store::close()
+{
+    if (base_ != nullptr)
+        munmap(const_cast<char*>(base_), size_);
+    base_ = nullptr;
+    size_ = 0;
+}
+#else
+bool Json_store::open(const char *)
+{
+    return false;
+}
+
+void Json_store::close()
+{
+}
+#endif
+
+Json_store_value Json_store::root() const
+{
+    if (base_ == nullptr)
+        return Json_store_value();
+    return Json_store_value(base_, &((const Json_store_header*)base_)->root);
+}
+
+// ------------------------------------------------------------ building
+
+Json_store_file::Json_store_file()
+    : fd_(-1), base_(nullptr), size_(0), capacity_(0)
+{
+}
+
+Json_store_file::~Json_store_file()
+{
+    close();
+}
+
+#ifndef _WINDOWS
+bool Json_store_file::create(const std::string &path, bool temporary)
+{
+    if (!temporary) {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        return fd_ >= 0;
+    }
+
+    // a fresh name, leaving any file called path alone
+    std::string name = path + ".XXXXXX";
+    fd_ = mkstemp(&name[0]);
+    if (fd_ < 0)
+        return false;
+    unlink(name.c_str());
+    return true;
+}
+
+bool Json_store_file::append(size_t n, uint64_t &offset)
+{
+    if (size_ + n > capacity_) {
+        uint64_t capacity = capacity_ > 0 ? capacity_ : JSON_STORE_INIT_SIZE;
+        while (size_ + n > capacity)
+            capacity *= 2;
+        if (ftruncate(fd_, capacity) != 0)
+            return false;
+        if (base_ != nullptr)
+            munmap(base_, capacity_);
+        void *p = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            base_ = nullptr;
+            capacity_ = 0;
+            return false;
+        }
+        base_ = (char*)p;
+        capacity_ = capacity;
+    }
+    offset = size_;
+    size_ += n;
+    return true;
+}
+
+bool Json_store_file::align(size_t align)
+{
+    uint64_t offset;
+    size_t pad = (align - size_ % align) % align;
+    if (pad == 0)
+        return true;
+    if (!append(pad, offset))
+        return false;
+    memset(at(offset), 0, pad);
+    return true;
+}
+
+bool Json_store_file::close()
+{
+    if (fd_ < 0)
+        return true;
+    bool ok = true;
+    if (base_ != nullptr)
+        munmap(base_, capacity_);
+    if (ftruncate(fd_, size_) != 0)
+        ok = false;
+    if (::close(fd_) != 0)
+        ok = false;
+    fd_ = -1;
+    base_ = nullptr;
+    size_ = capacity_ = 0;
+    return ok;
+}
+#else
+bool Json_store_file::create(const std::string &, bool)
+{
+    return false;
+}
+
+bool Json_store_file::append(size_t, uint64_t &)
+{
+    return false;
+}
+
+bool Json_store_file::align(size_t)
+{
+    return false;
+}
+
+bool Json_store_file::close()
+{
+    return true;
+}
+#endif
+
+Json_text_file::Json_text_file() : data_(nullptr), size_(0), mapped_(0)
+{
+}
+
+#ifndef _WINDOWS
+Json_text_file::~Json_text_file()
+{
+    if (mapped_ > 0)
+        munmap(const_cast<char*>(data_), mapped_);
+}
+
+bool Json_text_file::open(const char *path)
+{
+    if (mapped_ > 0)
+        munmap(const_cast<char*>(data_), mapped_);
+    data_ = nullptr;
+    size_ = mapped_ = 0;
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // zero pages reserved past the end, the file is mapped over their
+    // start: the bytes following it read as '\0' even when it fills
+    // its last page
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (size_t)st.st_size;
+    size_t mapped = (size / page + 1) * page;
+    void *p = mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED && size > 0 &&
+        mmap(p, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(p, mapped);
+        p = MAP_FAILED;
+    }
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    data_ = (const char*)p;
+    size_ = size;
+    mapped_ = mapped;
+    return true;
+}
+#else
+Json_text_file::~Json_text_file()
+{
+}
+
+bool Json_text_file::open(const char *)
+{
+    return false;
+}
+#endif
+
+} // end namespace JsonParser
@@ -0,0 +1,152 @@
+#ifndef __JSONPARSER_JSONSTORE_H_
+#define __JSONPARSER_JSONSTORE_H_
+
+#include "Json.h"
+
+#include <cstdint>
+#include <string>
+
+namespace JsonParser
+{
+
+// One value of a store file, 16 bytes whatever its type. Offsets are
+// from the start of the file, so a store is used in place once mapped.
+// the elements of an array are consecutive nodes, an object's members
+// are pairs of a key node (a string) and a value node.
+struct Json_store_node {
+    uint64_t data; // number bits, or offset of the string bytes ('\0'
+                   // terminated), elements or members
+    uint64_t info; // Json_type in the low 3 bits, above them the string
+                   // length or the element/member count
+};
+
+// A read only view of a value in a Json_store, mirroring the read side
+// of Json_value. Views are two pointers and valid as long as the store
+// stays open. Stores are trusted: offsets are not checked.
+class Json_store_value
+{
+public:
+    Json_store_value() : base_(nullptr), node_(nullptr) {}
+    Json_store_value(const char *base, const Json_store_node *node)
+        : base_(base), node_(node) {}
+
+    // false for the view returned when a lookup fails
+    bool exists() const { return node_ != nullptr; }
+
+    Json_type type() const { return (Json_type)(node_->info & 7); }
+    double number() const;
+    const char* get_string() const { return base_ + node_->data; }
+    size_t get_string_length() const { return (size_t)(node_->info >> 3); }
+
+    // elements of arrays, members of objects
+    size_t size() const { return (size_t)(node_->info >> 3); }
+    Json_store_value element(size_t index) const;
+    const char* get_key(size_t index) const;
+    size_t get_key_length(size_t index) const;
+    Json_store_value member(size_t index) const;
+    // the value of the first member named key, !exists() if absent or
+    // not an object
+    Json_store_value find(const char *key, size_t klen) const;
+
+    // deep copy of the subtree into the null value out
+    void copy_to(Json_value *out) const;
+
+private:
+    const Json_store_node* children() const
+    { return (const Json_store_node*)(base_ + node_->data); }
+
+    const char            *base_;
+    const Json_store_node *node_;
+};
+
+// A document parsed once into a file by Json::parse_store() and then
+// mapped read only, so only the parts being read take memory and the
+// OS pages them in and out as needed. Documents far larger than RAM
+// can be queried this way. POSIX only.
+class Json_store
+{
+public:
+    Json_store();
+    ~Json_store();
+
+    Json_store(const Json_store&) = delete;
+    Json_store& operator=(const Json_store&) = delete;
+
+    // false if path cannot be mapped or is not a store
+    bool open(const char *path);
+    void close();
+    bool is_open() const { return base_ != nullptr; }
+
+    Json_store_value root() const;
+    uint64_t file_size() const { return size_; }
+
+private:
+    const char *base_;
+    uint64_t    size_;
+};
+
+// ------------------------------------------------------------ building
+// used by Json::parse_store()
+
+#define JSON_STORE_MAGIC "JSONSTO1"
+
+// the first bytes of a store file. the magic is written last, so a
+// file left over by a failed build is never taken for a store.
+struct Json_store_header {
+    char            magic[8];
+    Json_store_node root;
+};
+
+// a file mapped read-write that grows as it is appended to. pointers
+// into it last only until the next append, offsets stay valid.
+class Json_store_file
+{
+public:
+    Json_store_file();
+    ~Json_store_file(); // unmaps and closes, keeping what was written
+
+    Json_store_file(const Json_store_file&) = delete;
+    Json_store_file& operator=(const Json_store_file&) = delete;
+
+    // a temporary file gets a unique name starting with path, is
+    // unlinked right away and gone once closed
+    bool create(const std::string &path, bool temporary);
+    // offset of n new bytes at the end, false if the file cannot grow
+    bool append(size_t n, uint64_t &offset);
+    // pads with zeros to a multiple of align
+    bool align(size_t align);
+    char* at(uint64_t offset) { return base_ + offset; }
+    uint64_t size() const { return size_; }
+    void truncate(uint64_t size) { size_ = size; }
+    // trims the file to size() and closes it, false on failure
+    bool close();
+
+private:
+    int      fd_;
+    char    *base_;
+    uint64_t size_, capacity_;
+};
+
+// a text file mapped read only and followed by a '\0', as the parser
+// expects
+class Json_text_file
+{
+public:
+    Json_text_file();
+    ~Json_text_file();
+
+    Json_text_file(const Json_text_file&) = delete;
+    Json_text_file& operator=(const Json_text_file&) = delete;
+
+    bool open(const char *path);
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char *data_;
+    size_t      size_, mapped_;
+};
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONSTORE_H_
@@ -0,0 +1,322 @@
+#include "JsonStream.h"
+
+#include <cstring>
+#include <functional>
+
+#ifdef JSONPARSER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef JSONPARSER_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace JsonParser
+{
+
+Json_stream_reader::Json_stream_reader(Json &js, FILE *in,
+                                       Json_compression compression,
+                                       size_t chunk_size, size_t max_chunks)
+    : js_(js), in_(in), compression_(compression),
+      chunk_size_(chunk_size > 0 ? chunk_size : 1),
+      max_chunks_(max_chunks > 0 ? max_chunks : 1), state_(Json_state::OK),
+      done_(false), stop_(false), input_state_(Json_state::OK),
+      base_(0), start_(0), scan_(0), depth_(0),
+      started_(false), in_string_(false), escape_(false), eof_(false)
+{
+    producer_ = std::thread(&Json_stream_reader::produce, this);
+}
+
+Json_stream_reader::~Json_stream_reader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    not_full_.notify_all();
+    producer_.join();
+}
+
+// ------------------------------------------------------------ producer
+
+// hands a decompressed chunk to the parsing thread, waiting while the
+// queue is full. false once the reader is being destroyed.
+bool Json_stream_reader::push(std::string &chunk)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this] { return chunks_.size() < max_chunks_ || stop_; });
+    if (stop_)
+        return false;
+    chunks_.push_back(std::string());
+    chunks_.back().swap(chunk);
+    not_empty_.notify_one();
+    return true;
+}
+
+void Json_stream_reader::finish(Json_state state)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    input_state_ = state;
+    not_empty_.notify_one();
+}
+
+typedef std::function<bool(std::string &chunk)> Push_chunk;
+
+// the decoders below start on the have bytes already read into input and
+// refill it from in as they go
+
+#ifdef JSONPARSER_HAVE_ZLIB
+// gzip, including files made of several concatenated gzip members
+static Json_state inflate_gzip(FILE *in, std::string &input, size_t have,
+                               size_t chunk_size, const Push_chunk &push)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return Json_state::DECOMPRESSION_ERROR;
+
+    Json_state state = Json_state::OK;
+    std::string chunk;
+    int ret = Z_OK;
+
+    zs.next_in = (Bytef*)&input[0];
+    zs.avail_in = (uInt)have;
+    while (true) {
+        if (zs.avail_in == 0) {
+            have = fread(&input[0], 1, input.size(), in);
+            if (have == 0) {
+                if (ferror(in) || ret != Z_STREAM_END)
+                    state = Json_state::DECOMPRESSION_ERROR;
+                break;
+            }
+            zs.next_in = (Bytef*)&input[0];
+            zs.avail_in = (uInt)have;
+        }
+        if (ret == Z_STREAM_END)
+            inflateReset(&zs); // the next member
+
+        chunk.resize(chunk_size);
+        zs.next_out = (Bytef*)&chunk[0];
+        zs.avail_out = (uInt)chunk_size;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            state = Json_state::DECOMPRESSION_ERROR;
+            break;
+        }
+        chunk.resize(chunk_size - zs.avail_out);
+        if (!chunk.empty() && !push(chunk))
+            break;
+    }
+    inflateEnd(&zs);
+    return state;
+}
+#endif
+
+#ifdef JSONPARSER_HAVE_ZSTD
+static Json_state decompress_zstd(FILE *in, std::string &input, size_t have,
+                                  size_t chunk_size, const Push_chunk &push)
+{
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == nullptr)
+        return Json_state::DECOMPRESSION_ERROR;
+
+    Json_state state = Json_state::OK;
+    std::string chunk;
+    size_t ret = 0;
+    bool stopped = false;
+
+    while (have > 0 && state == Json_state::OK && !stopped) {
+        ZSTD_inBuffer zin = { input.data(), have, 0 };
+        while (zin.pos < zin.size) {
+            chunk.resize(chunk_size);
+            ZSTD_outBuffer zout = { &chunk[0], chunk_size, 0 };
+            ret = ZSTD_decompressStream(dctx, &zout, &zin);
+            if (ZSTD_isError(ret)) {
+                state = Json_state::DECOMPRESSION_ERROR;
+                break;
+            }
+            chunk.resize(zout.pos);
+            if (!chunk.empty() && !push(chunk)) {
+                stopped = true;
+                break;
+            }
+        }
+        have = fread(&input[0], 1, input.size(), in);
+    }
+    // ret != 0 is a truncated frame
+    if (!stopped && state == Json_state::OK && (ferror(in) || ret != 0))
+        state = Json_state::DECOMPRESSION_ERROR;
+    ZSTD_freeDCtx(dctx);
+    return state;
+}
+#endif
+
+void Json_stream_reader::produce()
+{
+    Push_chunk push_chunk = [this](std::string &chunk) { return push(chunk); };
+
+    // the first block tells the format
+    std::string input(chunk_size_, '\0');
+    size_t have = fread(&input[0], 1, chunk_size_, in_);
+    if (ferror(in_)) {
+        finish(Json_state::DECOMPRESSION_ERROR);
+        return;
+    }
+
+    Json_compression compression = compression_;
+    if (compression == JSON_COMPRESSION_AUTO) {
+        const unsigned char *magic = (const unsigned char*)input.data();
+        if (have >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+            compression = JSON_COMPRESSION_GZIP;
+        else if (have >= 4 && magic[0] == 0x28 && magic[1] == 0xB5 &&
+                 magic[2] == 0x2F && magic[3] == 0xFD)
+            compression = JSON_COMPRESSION_ZSTD;
+        else
+            compression = JSON_COMPRESSION_NONE;
+    }
+
+    Json_state state = Json_state::OK;
+    switch (compression) {
+        case JSON_COMPRESSION_GZIP :
+#ifdef JSONPARSER_HAVE_ZLIB
+            state = inflate_gzip(in_, input, have, chunk_size_, push_chunk);
+#else
+            state = Json_state::DECOMPRESSION_ERROR;
+#endif
+            break;
+        case JSON_COMPRESSION_ZSTD :
+#ifdef JSONPARSER_HAVE_ZSTD
+            state = decompress_zstd(in_, input, have, chunk_size_, push_chunk);
+#else
+            state = Json_state::DECOMPRESSION_ERROR;
+#endif
+            break;
+        default :
+            input.resize(have);
+            while (!input.empty() && push(input)) {
+                input.resize(chunk_size_);
+                input.resize(fread(&input[0], 1, chunk_size_, in_));
+            }
+            if (ferror(in_))
+                state = Json_state::DECOMPRESSION_ERROR;
+    }
+    finish(state);
+}
+
+// ------------------------------------------------------------ consumer
+
+// appends the next chunk to pending_, false once the input is exhausted
+bool Json_stream_reader::pull()
+{
+    std::string chunk;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !chunks_.empty() || done_; });
+        if (chunks_.empty())
+            return false;
+        chunk.swap(chunks_.front());
+        chunks_.pop_front();
+    }
+    not_full_.notify_one();
+
+    // drop what was parsed already, once per chunk rather than per value
+    if (base_ > 0) {
+        pending_.erase(0, base_);
+        start_ -= base_;
+        scan_  -= base_;
+        base_ = 0;
+    }
+    pending_.append(chunk);
+    return true;
+}
+
+// finds where the top level value starting at start_ ends, picking up
+// where the last call stopped. only brackets and strings are tracked,
+// the parser checks everything else.
+bool Json_stream_reader::scan_value()
+{
+    const char *p = pending_.data();
+    for (size_t n = pending_.size(); scan_ < n; ++scan_) {
+        char ch = p[scan_];
+        if (in_string_) {
+            if (escape_)
+                escape_ = false;
+            else if (ch == '\\')
+                escape_ = true;
+            else if (ch == '"') {
+                in_string_ = false;
+                if (depth_ == 0) {
+                    ++scan_;
+                    return true;
+                }
+            }
+            continue;
+        }
+        switch (ch) {
+            case ' ' :
+            case '\t' :
+            case '\n' :
+            case '\r' :
+                if (depth_ > 0)
+                    break;
+                if (started_)
+                    return true; // end of a number or literal
+                start_ = scan_ + 1;
+                break;
+            case '"' :
+            case '[' :
+            case '{' :
+                if (depth_ == 0 && started_)
+                    return true; // a number or literal runs into the next value
+                started_ = true;
+                if (ch == '"')
+                    in_string_ = true;
+                else
+                    depth_++;
+                break;
+            case ']' :
+            case '}' :
+                started_ = true;
+                if (depth_ <= 1) {
+                    ++scan_;
+                    return true;
+                }
+                depth_--;
+                break;
+            default :
+                started_ = true;
+        }
+    }
+    return false;
+}
+
+bool Json_stream_reader::next(Json_value *val)
+{
+    while (!scan_value()) {
+        if (!eof_ && pull())
+            continue;
+        eof_ = true;
+        state_ = input_state_; // final once the producer is done
+        if (state_ != Json_state::OK || !started_)
+            return false;
+        break; // a value ending the input
+    }
+
+    // the value is parsed in place, the byte after it briefly replaced
+    // by the '\0' the parser expects
+    if (scan_ < pending_.size()) {
+        char after = pending_[scan_];
+        pending_[scan_] = '\0';
+        state_ = js_.parse(val, &pending_[start_], scan_ - start_);
+        pending_[scan_] = after;
+    } else {
+        state_ = js_.parse(val, pending_.c_str() + start_, scan_ - start_);
+    }
+
+    base_ = start_ = scan_;
+    depth_ = 0;
+    started_ = in_string_ = escape_ = false;
+    return state_ == Json_state::OK;
+}
+
+} // end namespace JsonParser
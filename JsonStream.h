@@ -0,0 +1,85 @@
+#ifndef __JSONPARSER_JSONSTREAM_H_
+#define __JSONPARSER_JSONSTREAM_H_
+
+#include "Json.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace JsonParser
+{
+
+enum Json_compression {
+    JSON_COMPRESSION_AUTO,  // detected from the magic number
+    JSON_COMPRESSION_NONE,
+    JSON_COMPRESSION_GZIP,  // needs JSONPARSER_HAVE_ZLIB
+    JSON_COMPRESSION_ZSTD   // needs JSONPARSER_HAVE_ZSTD
+};
+
+// Reads a stream of JSON values (NDJSON, or values simply following one
+// another) from a possibly compressed file. A background thread reads
+// and decompresses the input into a queue of at most max_chunks chunks
+// while the calling thread splits off complete values and parses them
+// in place. For a stream of many values decompression thus overlaps
+// parsing, and memory is bounded by the largest value plus the queue.
+//
+// Values are only parsed once complete, parsing does not resume across
+// chunks: a stream holding a single document gets neither overlap nor
+// bound, it is buffered whole and parsed after all of it has been
+// decompressed.
+class Json_stream_reader
+{
+public:
+    // in must stay open until the reader is destroyed; parsing goes
+    // through js, with its limits and options
+    Json_stream_reader(Json &js, FILE *in,
+                       Json_compression compression = JSON_COMPRESSION_AUTO,
+                       size_t chunk_size = 64 * 1024, size_t max_chunks = 4);
+    ~Json_stream_reader();
+
+    Json_stream_reader(const Json_stream_reader&) = delete;
+    Json_stream_reader& operator=(const Json_stream_reader&) = delete;
+
+    // parses the next value into val. false at the end of the stream or
+    // on an error, which state() reports (OK at a clean end). a value
+    // that fails to parse is skipped, so reading may go on after it;
+    // DECOMPRESSION_ERROR (unreadable, corrupt or unsupported input)
+    // ends the stream.
+    bool next(Json_value *val);
+    Json_state state() const { return state_; }
+
+private:
+    void produce();
+    bool push(std::string &chunk);
+    void finish(Json_state state);
+    bool pull();
+    bool scan_value();
+
+    Json              &js_;
+    FILE              *in_;
+    Json_compression   compression_;
+    size_t             chunk_size_;
+    size_t             max_chunks_;
+    Json_state         state_;
+
+    // shared with the producer thread
+    std::mutex              mutex_;
+    std::condition_variable not_full_, not_empty_;
+    std::deque<std::string> chunks_;
+    bool                    done_, stop_;
+    Json_state              input_state_;
+    std::thread             producer_;
+
+    // text not yet parsed and where scanning it stopped
+    std::string pending_;
+    size_t      base_, start_, scan_, depth_;
+    bool        started_, in_string_, escape_, eof_;
+};
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONSTREAM_H_
@@ -0,0 +1,312 @@
+#include "JsonWriter.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WINDOWS
+#include <unistd.h>
+#endif
+
+namespace JsonParser
+{
+
+bool Json_string_sink::write(const char *data, size_t len)
+{
+    out_.append(data, len);
+    return true;
+}
+
+bool Json_callback_sink::write(const char *data, size_t len)
+{
+    return cb_(data, len);
+}
+
+#ifndef _WINDOWS
+bool Json_fd_sink::write(const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len  -= n;
+    }
+    return true;
+}
+
+Json_iovec_sink::Json_iovec_sink(const struct iovec *iov, size_t iovcnt)
+    : iov_(iov), iovcnt_(iovcnt), cur_(0), off_(0), written_(0)
+{
+}
+
+bool Json_iovec_sink::write(const char *data, size_t len)
+{
+    while (len > 0) {
+        if (cur_ == iovcnt_)
+            return false;
+
+        size_t room = iov_[cur_].iov_len - off_;
+        size_t n = len < room ? len : room;
+        memcpy((char*)iov_[cur_].iov_base + off_, data, n);
+        data += n;
+        len  -= n;
+        off_ += n;
+        written_ += n;
+        if (off_ == iov_[cur_].iov_len) {
+            cur_++;
+            off_ = 0;
+        }
+    }
+    return true;
+}
+#endif
+
+Json_writer::Json_writer(Json_sink &sink, size_t buffer_size, int indent)
+    : sink_(sink), buf_size_(buffer_size > 64 ? buffer_size : 64), used_(0),
+      indent_(indent), good_(true), after_key_(false)
+{
+    buf_ = (char*)malloc(buf_size_);
+}
+
+Json_writer::~Json_writer()
+{
+    flush();
+    free(buf_);
+}
+
+bool Json_writer::flush()
+{
+    if (good_ && used_ > 0)
+        good_ = sink_.write(buf_, used_);
+    used_ = 0;
+    return good_;
+}
+
+void Json_writer::put(const char *data, size_t len)
+{
+    if (len > buf_size_ - used_) {
+        flush();
+        if (len >= buf_size_) {
+            // too big to be worth buffering
+            if (good_)
+                good_ = sink_.write(data, len);
+            return;
+        }
+    }
+    memcpy(buf_ + used_, data, len);
+    used_ += len;
+}
+
+void Json_writer::putc(char ch)
+{
+    if (used_ == buf_size_)
+        flush();
+    buf_[used_++] = ch;
+}
+
+void Json_writer::put_newline()
+{
+    putc('\n');
+    for (size_t i = indent_ * levels_.size(); i > 0; --i)
+        putc(' ');
+}
+
+void Json_writer::put_string(const char *str, size_t len)
+{
+    static const char hex_digits[] = "0123456789ABCDEF";
+
+    putc('"');
+    const char *run = str;
+    for (const char *p = str, *end = str + len; p < end; ++p) {
+        unsigned char ch = (unsigned char)*p;
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+
+        // copy the run of plain characters in one go
+        put(run, p - run);
+        run = p + 1;
+        switch (ch) {
+            case '\"' : put("\\\"", 2); break;
+            case '\\' : put("\\\\", 2); break;
+            case '\b' : put("\\b", 2);  break;
+            case '\f' : put("\\f", 2);  break;
+            case '\n' : put("\\n", 2);  break;
+            case '\r' : put("\\r", 2);  break;
+            case '\t' : put("\\t", 2);  break;
+            default : {
+                char esc[6] = { '\\', 'u', '0', '0',
+                                hex_digits[ch >> 4], hex_digits[ch & 15] };
+                put(esc, 6);
+            }
+        }
+    }
+    put(run, str + len - run);
+    putc('"');
+}
+
+void Json_writer::before_value()
+{
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (levels_.empty())
+        return;
+
+    Level &level = levels_.back();
+    assert(!level.object); // object members need a key first
+    if (level.count++ > 0)
+        putc(',');
+    if (indent_ > 0)
+        put_newline();
+}
+
+bool Json_writer::start_object()
+{
+    before_value();
+    putc('{');
+    levels_.push_back(Level{ true, 0 });
+    return good_;
+}
+
+bool Json_writer::end_object()
+{
+    assert(!levels_.empty() && levels_.back().object && !after_key_);
+    size_t count = levels_.back().count;
+    levels_.pop_back();
+    if (indent_ > 0 && count > 0)
+        put_newline();
+    putc('}');
+    return good_;
+}
+
+bool Json_writer::start_array()
+{
+    before_value();
+    putc('[');
+    levels_.push_back(Level{ false, 0 });
+    return good_;
+}
+
+bool Json_writer::end_array()
+{
+    assert(!levels_.empty() && !levels_.back().object);
+    size_t count = levels_.back().count;
+    levels_.pop_back();
+    if (indent_ > 0 && count > 0)
+        put_newline();
+    putc(']');
+    return good_;
+}
+
+bool Json_writer::key(const char *key, size_t klen)
+{
+    assert(!levels_.empty() && levels_.back().object && !after_key_);
+    Level &level = levels_.back();
+    if (level.count++ > 0)
+        putc(',');
+    if (indent_ > 0)
+        put_newline();
+    put_string(key, klen);
+    if (indent_ > 0)
+        put(": ", 2);
+    else
+        putc(':');
+    after_key_ = true;
+    return good_;
+}
+
+bool Json_writer::null()
+{
+    before_value();
+    put("null", 4);
+    return good_;
+}
+
+bool Json_writer::boolean(bool b)
+{
+    before_value();
+    if (b)
+        put("true", 4);
+    else
+        put("false", 5);
+    return good_;
+}
+
+bool Json_writer::number(double n)
+{
+    // JSON has no representation for nan/inf
+    if (!std::isfinite(n))
+        return null();
+
+    char buf[32];
+    before_value();
+    put(buf, snprintf(buf, sizeof(buf), "%.17g", n));
+    return good_;
+}
+
+// packed arrays: the elements of a flat number array, without the per
+// value dispatch
+void Json_writer::put_numbers(const double *num, size_t size)
+{
+    char buf[32];
+    Level &level = levels_.back();
+
+    for (size_t i = 0; i < size && good_; ++i) {
+        if (!std::isfinite(num[i])) {
+            null();
+            continue;
+        }
+        if (level.count++ > 0)
+            putc(',');
+        if (indent_ > 0)
+            put_newline();
+        put(buf, snprintf(buf, sizeof(buf), "%.17g", num[i]));
+    }
+}
+
+bool Json_writer::string(const char *str, size_t len)
+{
+    before_value();
+    put_string(str, len);
+    return good_;
+}
+
+bool Json_writer::value(const Json_value *jv)
+{
+    switch (jv->type) {
+        case Json_type::JSON_NULL :   return null();
+        case Json_type::JSON_FALSE :  return boolean(false);
+        case Json_type::JSON_TRUE :   return boolean(true);
+        case Json_type::JSON_NUMBER : return number(jv->number);
+        case Json_type::JSON_STRING : return string(jv->get_string(), jv->get_string_length());
+        case Json_type::JSON_ARRAY :
+            start_array();
+            if (jv->is_packed()) {
+                put_numbers(jv->narr.num, jv->narr.size);
+            } else {
+                for (size_t i = 0; i < jv->arr.size && good_; ++i)
+                    value(&jv->arr.elem[i]);
+            }
+            return end_array();
+        case Json_type::JSON_OBJECT :
+            start_object();
+            for (size_t i = 0; i < jv->obj.size && good_; ++i) {
+                const Json_member &m = jv->obj.mem[i];
+                key(m.get_key(), m.get_key_length());
+                value(&jv->obj.mem[i].val);
+            }
+            return end_object();
+    }
+    assert(0 && "invalid type");
+    return false;
+}
+
+} // end namespace JsonParser
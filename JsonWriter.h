@@ -0,0 +1,136 @@
+#ifndef __JSONPARSER_JSONWRITER_H_
+#define __JSONPARSER_JSONWRITER_H_
+
+#include "Json.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <sys/uio.h>
+#endif
+
+namespace JsonParser
+{
+
+// Destination of the bytes produced by Json_writer. write() returns
+// false on failure, after which the writer drops all further output.
+class Json_sink
+{
+public:
+    virtual ~Json_sink() {}
+    virtual bool write(const char *data, size_t len) = 0;
+};
+
+class Json_string_sink : public Json_sink
+{
+public:
+    explicit Json_string_sink(std::string &out) : out_(out) {}
+    bool write(const char *data, size_t len) override;
+
+private:
+    std::string &out_;
+};
+
+class Json_callback_sink : public Json_sink
+{
+public:
+    typedef std::function<bool(const char *data, size_t len)> Callback;
+
+    explicit Json_callback_sink(Callback cb) : cb_(cb) {}
+    bool write(const char *data, size_t len) override;
+
+private:
+    Callback cb_;
+};
+
+#ifndef _WINDOWS
+// writes to a file descriptor, retrying short writes and EINTR
+class Json_fd_sink : public Json_sink
+{
+public:
+    explicit Json_fd_sink(int fd) : fd_(fd) {}
+    bool write(const char *data, size_t len) override;
+
+private:
+    int fd_;
+};
+
+// scatters output over a caller provided iovec list, fails once full
+class Json_iovec_sink : public Json_sink
+{
+public:
+    Json_iovec_sink(const struct iovec *iov, size_t iovcnt);
+    bool write(const char *data, size_t len) override;
+
+    // total bytes written so far
+    size_t size() const { return written_; }
+
+private:
+    const struct iovec *iov_;
+    size_t iovcnt_;
+    size_t cur_, off_;
+    size_t written_;
+};
+#endif
+
+// SAX style writer: emits JSON as it is produced into a fixed size
+// buffer which is handed to the sink whenever it fills up. Each call
+// returns false once the sink has failed. Misuse (e.g. a value where
+// a key is expected) is caught by assert.
+class Json_writer
+{
+public:
+    // indent > 0 pretty prints with that many spaces per level
+    explicit Json_writer(Json_sink &sink, size_t buffer_size = 4096,
+                         int indent = 0);
+    ~Json_writer(); // flushes
+
+    Json_writer(const Json_writer&) = delete;
+    Json_writer& operator=(const Json_writer&) = delete;
+
+    bool start_object();
+    bool end_object();
+    bool start_array();
+    bool end_array();
+
+    bool key(const char *key, size_t klen);
+    bool key(const std::string &key) { return this->key(key.data(), key.size()); }
+
+    bool null();
+    bool boolean(bool b);
+    bool number(double n);
+    bool string(const char *str, size_t len);
+    bool string(const std::string &str) { return string(str.data(), str.size()); }
+
+    // writes a whole tree
+    bool value(const Json_value *jv);
+
+    // hands buffered output to the sink
+    bool flush();
+    bool good() const { return good_; }
+
+private:
+    struct Level { bool object; size_t count; };
+
+    void put(const char *data, size_t len);
+    void putc(char ch);
+    void put_string(const char *str, size_t len);
+    void put_numbers(const double *num, size_t size);
+    void put_newline();
+    void before_value();
+
+    Json_sink         &sink_;
+    char              *buf_;
+    size_t             buf_size_;
+    size_t             used_;
+    int                indent_;
+    bool               good_;
+    bool               after_key_;
+    std::vector<Level> levels_;
+};
+
+} // end of JsonParser
+
+#endif // __JSONPARSER_JSONWRITER_H_
@@ -1,6 +1,19 @@
 #include "Json.h"
-
+#include "JsonAllocator.h"
+#include "JsonDocument.h"
+#include "JsonPatch.h"
+#include "JsonSchema.h"
+#include "JsonStore.h"
+#include "JsonStream.h"
+#include "JsonWriter.h"
+
+#include <cmath>
 #include <cstring>
+#include <thread>
+#include <vector>
+#ifdef JSONPARSER_HAVE_ZLIB
+#include <zlib.h>
+#endif
 using namespace JsonParser;
 
 static int main_ret = 0;
@@ -40,6 +53,7 @@ static int test_pass = 0;
         Json js; \
         Json_value val; \
         EXPECT_EQ_INT(error, js.parse(&val, jstr)); \
+        EXPECT_EQ_INT(error, js.validate(jstr)); \
     } while (0)
 
 #define TEST_VALUE(expect_type, jstr) \
@@ -65,7 +79,7 @@ static int test_pass = 0;
         Json_value val; \
         EXPECT_EQ_INT(Json_state::OK, js.parse(&val, jstr)); \
         EXPECT_EQ_INT(Json_type::JSON_STRING, val.type); \
-        EXPECT_EQ_STRING(expect_str, val.str.pch, val.str.len); \
+        EXPECT_EQ_STRING(expect_str, val.get_string(), val.get_string_length()); \
     } while (0)
 
 #if defined(_MSC_VER)
@@ -288,7 +302,7 @@ static void test_parse_array()
         EXPECT_EQ_INT(Json_type::JSON_STRING, elem[4].type);
 
         EXPECT_EQ_DOUBLE(123.0, elem[3].number);
-        EXPECT_EQ_STRING("abc", elem[4].str.pch, 3);
+        EXPECT_EQ_STRING("abc", elem[4].get_string(), 3);
     }
 
     {
@@ -361,24 +375,25 @@ static void test_parse_object()
         EXPECT_EQ_INT(Json_type::JSON_OBJECT, val.type);
         EXPECT_EQ_SIZE_T(7, val.obj.size);
 
-        EXPECT_EQ_STRING("n", lv1_mem[0].key, lv1_mem[0].klen);
+        EXPECT_EQ_STRING("n", lv1_mem[0].get_key(), lv1_mem[0].get_key_length());
         EXPECT_EQ_INT(Json_type::JSON_NULL, lv1_mem[0].val.type);
 
-        EXPECT_EQ_STRING("f", lv1_mem[1].key, lv1_mem[1].klen);
+        EXPECT_EQ_STRING("f", lv1_mem[1].get_key(), lv1_mem[1].get_key_length());
         EXPECT_EQ_INT(Json_type::JSON_FALSE, lv1_mem[1].val.type);
 
-        EXPECT_EQ_STRING("t", lv1_mem[2].key, lv1_mem[2].klen);
+        EXPECT_EQ_STRING("t", lv1_mem[2].get_key(), lv1_mem[2].get_key_length());
         EXPECT_EQ_INT(Json_type::JSON_TRUE, lv1_mem[2].val.type);
 
-        EXPECT_EQ_STRING("i", lv1_mem[3].key, lv1_mem[3].klen);
+        EXPECT_EQ_STRING("i", lv1_mem[3].get_key(), lv1_mem[3].get_key_length());
         EXPECT_EQ_INT(Json_type::JSON_NUMBER, lv1_mem[3].val.type);
         EXPECT_EQ_DOUBLE(123.0, lv1_mem[3].val.number);
 
-        EXPECT_EQ_STRING("s", lv1_mem[4].key, lv1_mem[4].klen);
+        EXPECT_EQ_STRING("s", lv1_mem[4].get_key(), lv1_mem[4].get_key_length());
         EXPECT_EQ_INT(Json_type::JSON_STRING, lv1_mem[4].val.type);
-        EXPECT_EQ_STRING("abc", lv1_mem[4].val.str.pch, lv1_mem[4].val.str.len);
+        EXPECT_EQ_STRING("abc", lv1_mem[4].val.get_string(),
+                         lv1_mem[4].val.get_string_length());
 
-        EXPECT_EQ_STRING("a", lv1_mem[5].key, lv1_mem[5].klen);
+        EXPECT_EQ_STRING("a", lv1_mem[5].get_key(), lv1_mem[5].get_key_length());
         {
             auto &lv2_type = lv1_mem[5].val.type;
             auto &lv2_size = lv1_mem[5].val.arr.size;
@@ -393,7 +408,7 @@ static void test_parse_object()
             }
         }
 
-        EXPECT_EQ_STRING("o", lv1_mem[6].key, lv1_mem[6].klen);
+        EXPECT_EQ_STRING("o", lv1_mem[6].get_key(), lv1_mem[6].get_key_length());
         {
             auto &lv2_type = lv1_mem[6].val.type;
             auto &lv2_size = lv1_mem[6].val.obj.size;
@@ -404,8 +419,8 @@ static void test_parse_object()
 
             for (size_t i = 0; i < 3; ++i) {
                 // key
-                EXPECT_TRUE('1' + i == lv2_mem[i].key[0]);
-                EXPECT_EQ_SIZE_T(1, lv2_mem[i].klen);
+                EXPECT_TRUE('1' + i == lv2_mem[i].get_key()[0]);
+                EXPECT_EQ_SIZE_T(1, lv2_mem[i].get_key_length());
 
                 // number
                 EXPECT_EQ_INT(Json_type::JSON_NUMBER, lv2_mem[i].val.type);
@@ -448,6 +463,315 @@ static void test_parse_miss_comma_or_curly_bracket()
 #endif
 }
 
+static void test_parse_intern_keys()
+{
+    Json_symbol_table symtab;
+    Json js;
+    js.set_symbol_table(&symtab);
+
+    {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val,
+            "[ { \"id\" : 1, \"name\" : \"a\" }, "
+            "  { \"id\" : 2, \"name\" : \"b\" } ]"));
+        EXPECT_EQ_SIZE_T(2, symtab.size());
+
+        auto &elem = val.arr.elem;
+        EXPECT_TRUE(elem[0].obj.mem[0].key == elem[1].obj.mem[0].key);
+        EXPECT_TRUE(elem[0].obj.mem[1].key == elem[1].obj.mem[1].key);
+        EXPECT_EQ_STRING("name", elem[1].obj.mem[1].get_key(),
+                         elem[1].obj.mem[1].get_key_length());
+
+        const char *name = symtab.lookup("name", 4);
+        EXPECT_TRUE(name == elem[0].obj.mem[1].key);
+        EXPECT_TRUE(symtab.lookup("nope", 4) == nullptr);
+
+        const Json_value *pv = elem[1].find(name, 4);
+        EXPECT_TRUE(pv != nullptr);
+        EXPECT_EQ_STRING("b", pv->get_string(), pv->get_string_length());
+        EXPECT_TRUE(elem[1].find("id", 2) != nullptr);
+        EXPECT_TRUE(elem[1].find("i", 1) == nullptr);
+    }
+
+    // the table is shared across documents
+    {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "{ \"id\" : 3, \"ts\" : 0 }"));
+        EXPECT_EQ_SIZE_T(3, symtab.size());
+        EXPECT_TRUE(symtab.lookup("id", 2) == val.obj.mem[0].key);
+    }
+
+    // a failed parse frees its members but not their interned keys
+    {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::MISS_COLON, js.parse(&val, "{ \"id\" : 4, \"a\" }"));
+        EXPECT_EQ_INT(Json_type::JSON_NULL, val.type);
+        EXPECT_EQ_SIZE_T(4, symtab.size());
+        const char *a = symtab.lookup("a", 1);
+        EXPECT_TRUE(a != nullptr);
+        EXPECT_EQ_STRING("id", symtab.lookup("id", 2), 2);
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "{ \"a\" : 5 }"));
+        EXPECT_EQ_SIZE_T(4, symtab.size());
+        EXPECT_TRUE(a == val.obj.mem[0].key);
+    }
+
+    {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "{ \"g\" : 1 }"));
+        EXPECT_TRUE(Json_symbol_table::global().intern("g", 1) !=
+                    val.obj.mem[0].key);
+    }
+}
+
+static void test_parse_reuse()
+{
+    Json js;
+
+    // the same instance handles a stream of messages, including failures
+    for (int i = 0; i < 3; ++i) {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val,
+            "{ \"a\" : [ 1, \"two\", { \"b\" : [ ] } ], \"c\" : \"d\" }"));
+        EXPECT_EQ_SIZE_T(2, val.obj.size);
+        EXPECT_EQ_SIZE_T(3, val.obj.mem[0].val.arr.size);
+        EXPECT_EQ_STRING("two", val.obj.mem[0].val.arr.elem[1].get_string(),
+                         val.obj.mem[0].val.arr.elem[1].get_string_length());
+        EXPECT_EQ_STRING("d", val.obj.mem[1].val.get_string(),
+                         val.obj.mem[1].val.get_string_length());
+
+        Json_value bad;
+        EXPECT_EQ_INT(Json_state::MISS_COMMA_OR_SQUARE_BRACKET,
+                      js.parse(&bad, "[ \"x\", [ 1, { \"k\" : \"v\" } 2 ]"));
+    }
+
+    js.set_scratch_limit(0);
+    {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[ \"abc\", [ 1, 2 ] ]"));
+        EXPECT_EQ_STRING("abc", val.arr.elem[0].get_string(),
+                         val.arr.elem[0].get_string_length());
+    }
+
+    js.reset();
+    {
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[ 1, 2, 3 ]"));
+        EXPECT_EQ_SIZE_T(3, val.arr.size);
+    }
+}
+
+#define TEST_UTF8(error, jstr) \
+    do {\
+        Json js; \
+        Json_value val; \
+        js.set_validate_utf8(true); \
+        EXPECT_EQ_INT(error, js.parse(&val, jstr)); \
+    } while (0)
+
+static void test_parse_utf8()
+{
+    TEST_UTF8(Json_state::OK, "\"\xC2\xA2 \xE2\x82\xAC \xF0\x9D\x84\x9E\"");
+    TEST_UTF8(Json_state::OK, "\"\xED\x9F\xBF \xEE\x80\x80 \xF4\x8F\xBF\xBF\"");
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\x80\"");          /* lone continuation */
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xC0\xAF\"");      /* overlong */
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xE0\x80\xAF\"");  /* overlong */
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xED\xA0\x80\"");  /* surrogate */
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xF4\x90\x80\x80\""); /* > U+10FFFF */
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xF5\x80\x80\x80\"");
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xE2\x82\"");      /* truncated */
+    TEST_UTF8(Json_state::INVALID_UTF8, "\"\xE2\x82");
+    TEST_UTF8(Json_state::INVALID_UTF8, "{\"\xFF\":1}");
+
+    /* long runs go through the vectorized scan */
+    TEST_UTF8(Json_state::OK, "[\"0123456789abcdef0123456789abcdef\xC2\xA2\"]");
+    TEST_UTF8(Json_state::INVALID_UTF8, "[\"0123456789abcdef0123456789abcde\xC2\"]");
+    TEST_UTF8(Json_state::INVALID_STRING_CHAR, "\"0123456789abcdef0123\x01\"");
+
+    {
+        Json js;
+        Json_value val;
+
+        js.set_validate_utf8(true);
+        EXPECT_EQ_INT(Json_state::OK,
+                      js.parse(&val, "\"0123456789abcdef\\n\xE2\x82\xAC" "0123456789abcdef\""));
+        EXPECT_EQ_STRING("0123456789abcdef\n\xE2\x82\xAC" "0123456789abcdef",
+                         val.get_string(), val.get_string_length());
+    }
+
+    /* off by default */
+    TEST_ERROR(Json_state::OK, "\"\xC0\xAF\"");
+}
+
+#define TEST_MINIFY(expect, jstr) \
+    do { \
+        Json js; \
+        std::string out; \
+        EXPECT_EQ_INT(Json_state::OK, js.minify(jstr, out)); \
+        EXPECT_EQ_STRING(expect, out.c_str(), out.size()); \
+    } while (0)
+
+static void test_minify()
+{
+    TEST_MINIFY("null", " null ");
+    TEST_MINIFY("-1.5e+10", "\t-1.5e+10\n");
+    TEST_MINIFY("\" a \\n \\u0041 \"", " \" a \\n \\u0041 \" ");
+    TEST_MINIFY("[]", "[ ]");
+    TEST_MINIFY("{}", "{ }");
+    TEST_MINIFY("[null,false,true,123,\"a b\"]", "[ null , false , true , 123 , \"a b\" ]");
+    TEST_MINIFY("{\"a\":[1,{\"b\":{}}],\"c\":\"d\"}",
+                " {\r\n \"a\" : [ 1 , { \"b\" : { } } ] ,\n \"c\" : \"d\" } ");
+
+    {
+        Json js;
+        std::string out;
+
+        EXPECT_EQ_INT(Json_state::MISS_COLON, js.minify("{ \"a\" 1 }", out));
+        EXPECT_EQ_INT(Json_state::OK, js.validate(" [ { \"a\" : \"b\" } ] "));
+
+        js.set_validate_utf8(true);
+        EXPECT_EQ_INT(Json_state::INVALID_UTF8, js.validate("[\"\xC0\xAF\"]"));
+    }
+}
+
+static void test_parse_inline_strings()
+{
+    Json js;
+    Json_value val;
+
+    /* up to JSON_INLINE_CAPACITY bytes stay inside the value, keys one less */
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val,
+        "{\"k\":\"ok\",\"0123456789abcd\":\"0123456789abcde\","
+        "\"0123456789abcde\":\"0123456789abcdef\",\"e\":\"\",\"z\":\"a\\u0000b\"}"));
+    const Json_member *mem = val.obj.mem;
+    EXPECT_TRUE(mem[0].kflags & JSON_KEY_INLINE);
+    EXPECT_TRUE(mem[0].val.flags & JSON_INLINE_STRING);
+    EXPECT_EQ_STRING("ok", mem[0].val.get_string(), mem[0].val.get_string_length());
+    EXPECT_TRUE(mem[1].kflags & JSON_KEY_INLINE);
+    EXPECT_TRUE(mem[1].val.flags & JSON_INLINE_STRING);
+    EXPECT_EQ_STRING("0123456789abcd", mem[1].get_key(), mem[1].get_key_length());
+    EXPECT_EQ_STRING("0123456789abcde", mem[1].val.get_string(),
+                     mem[1].val.get_string_length());
+    EXPECT_FALSE(mem[2].kflags & JSON_KEY_INLINE);
+    EXPECT_FALSE(mem[2].val.flags & JSON_INLINE_STRING);
+    EXPECT_EQ_STRING("0123456789abcde", mem[2].get_key(), mem[2].get_key_length());
+    EXPECT_EQ_STRING("0123456789abcdef", mem[2].val.get_string(),
+                     mem[2].val.get_string_length());
+    EXPECT_EQ_STRING("", mem[3].val.get_string(), mem[3].val.get_string_length());
+    EXPECT_EQ_STRING("a\0b", mem[4].val.get_string(), mem[4].val.get_string_length());
+    EXPECT_TRUE(val.find("0123456789abcd", 14) == &mem[1].val);
+    EXPECT_TRUE(val.find("0123456789abcde", 15) == &mem[2].val);
+
+    /* setters pick the representation and may be fed their own contents */
+    Json_value v;
+    v.set_string("0123456789abcdefgh", 18);
+    EXPECT_FALSE(v.flags & JSON_INLINE_STRING);
+    v.set_string(v.get_string() + 8, 10);
+    EXPECT_TRUE(v.flags & JSON_INLINE_STRING);
+    EXPECT_EQ_STRING("89abcdefgh", v.get_string(), v.get_string_length());
+    v.set_string(v.get_string() + 1, 3);
+    EXPECT_EQ_STRING("9ab", v.get_string(), v.get_string_length());
+
+    Json_member m;
+    m.set_key("long enough to be on the heap", 29);
+    m.set_key(m.get_key(), 4);
+    EXPECT_TRUE(m.kflags & JSON_KEY_INLINE);
+    EXPECT_EQ_STRING("long", m.get_key(), m.get_key_length());
+    m.set_key("0123456789abcd", 14);
+    EXPECT_TRUE(m.kflags & JSON_KEY_INLINE);
+    EXPECT_EQ_STRING("0123456789abcd", m.get_key(), m.get_key_length());
+    m.set_key("0123456789abcde", 15);
+    EXPECT_FALSE(m.kflags & JSON_KEY_INLINE);
+    EXPECT_EQ_STRING("0123456789abcde", m.get_key(), m.get_key_length());
+
+    Json_value copy;
+    copy.copy(&val);
+    EXPECT_TRUE(copy.equals(&val));
+    EXPECT_TRUE(copy.hash() == val.hash());
+    EXPECT_TRUE(copy.obj.mem[0].val.flags & JSON_INLINE_STRING);
+
+    std::string out;
+    js.stringify(out, &val);
+    EXPECT_EQ_STRING("{\"k\":\"ok\",\"0123456789abcd\":\"0123456789abcde\","
+        "\"0123456789abcde\":\"0123456789abcdef\",\"e\":\"\",\"z\":\"a\\u0000b\"}",
+        out.c_str(), out.size());
+}
+
+static void test_parse_limits()
+{
+    Json js;
+    Json_value val;
+    Json_limits limits;
+
+    limits.max_depth = 2;
+    js.set_limits(limits);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[[1],{\"a\":2}]"));
+    val.set_null();
+    EXPECT_EQ_INT(Json_state::DEPTH_LIMIT_EXCEEDED, js.parse(&val, "[[[1]]]"));
+    EXPECT_EQ_INT(Json_state::DEPTH_LIMIT_EXCEEDED, js.validate("{\"a\":{\"b\":{}}}"));
+    EXPECT_EQ_INT(Json_state::DEPTH_LIMIT_EXCEEDED,
+                  js.parse(&val, std::string(100000, '[')));
+
+    limits = Json_limits();
+    limits.max_nodes = 4;
+    js.set_limits(limits);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[1,2,3]"));
+    val.set_null();
+    EXPECT_EQ_INT(Json_state::NODE_LIMIT_EXCEEDED, js.parse(&val, "[1,2,3,4]"));
+    EXPECT_EQ_INT(Json_state::NODE_LIMIT_EXCEEDED, js.validate("{\"a\":[1,2,3]}"));
+
+    limits = Json_limits();
+    limits.max_string_length = 3;
+    js.set_limits(limits);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "{\"abc\":\"\\u20ac\"}"));
+    val.set_null();
+    EXPECT_EQ_INT(Json_state::STRING_TOO_LONG, js.parse(&val, "\"abcd\""));
+    EXPECT_EQ_INT(Json_state::STRING_TOO_LONG, js.parse(&val, "{\"abcd\":1}"));
+    EXPECT_EQ_INT(Json_state::STRING_TOO_LONG, js.parse(&val, "\"\\n\\n\\n\\n\""));
+    EXPECT_EQ_INT(Json_state::STRING_TOO_LONG, js.validate("[\"abcd\"]"));
+
+    limits = Json_limits();
+    limits.max_total_bytes = 4 * sizeof(Json_value);
+    js.set_limits(limits);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[1,2,3,4]"));
+    val.set_null();
+    EXPECT_EQ_INT(Json_state::MEMORY_LIMIT_EXCEEDED, js.parse(&val, "[1,2,3,4,5]"));
+    EXPECT_EQ_INT(Json_state::MEMORY_LIMIT_EXCEEDED,
+                  js.parse(&val, "[\"abcdefghijklmnopqrstuvwxyz\",\"b\",\"c\"]"));
+
+    /* packed arrays are charged their doubles, until a non-number */
+    js.set_pack_numbers(true);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[1,2,3,4,5,6,7,8,9,10,11,12]"));
+    EXPECT_TRUE(val.is_packed());
+    val.set_null();
+    EXPECT_EQ_INT(Json_state::MEMORY_LIMIT_EXCEEDED, js.parse(&val, "[1,2,3,4,null]"));
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[1,2,3,null]"));
+    val.set_null();
+    js.set_pack_numbers(false);
+
+    limits = Json_limits();
+    limits.timeout_us = 1;
+    js.set_limits(limits);
+    std::string big = "[";
+    for (int i = 0; i < 1000000; ++i)
+        big += "0,";
+    big += "0]";
+    EXPECT_EQ_INT(Json_state::DEADLINE_EXCEEDED, js.parse(&val, big));
+    EXPECT_EQ_INT(Json_state::DEADLINE_EXCEEDED, js.validate(big));
+
+    /* the parser stays usable after a failed parse */
+    js.set_limits(Json_limits());
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, big));
+    EXPECT_EQ_SIZE_T(1000001, val.arr.size);
+}
+
 static void test_parse()
 {
     test_parse_null();
@@ -476,12 +800,1102 @@ static void test_parse()
     test_parse_miss_key();
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
+
+    test_parse_intern_keys();
+    test_parse_reuse();
+    test_parse_utf8();
+    test_parse_inline_strings();
+    test_parse_limits();
+
+    test_minify();
 }
 
 
+#define TEST_ROUNDTRIP(jstr) \
+    do { \
+        Json js; \
+        Json_value val; \
+        std::string out; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, jstr)); \
+        js.stringify(out, &val); \
+        EXPECT_EQ_STRING(jstr, out.c_str(), out.size()); \
+    } while (0)
+
+static void test_stringify_number()
+{
+    TEST_ROUNDTRIP("0");
+    TEST_ROUNDTRIP("-0");
+    TEST_ROUNDTRIP("1");
+    TEST_ROUNDTRIP("-1");
+    TEST_ROUNDTRIP("1.5");
+    TEST_ROUNDTRIP("-1.5");
+    TEST_ROUNDTRIP("3.25");
+    TEST_ROUNDTRIP("1e+20");
+    TEST_ROUNDTRIP("1.234e+20");
+    TEST_ROUNDTRIP("1.234e-20");
+
+    TEST_ROUNDTRIP("1.0000000000000002"); /* the smallest number > 1 */
+    TEST_ROUNDTRIP("4.9406564584124654e-324"); /* minimum denormal */
+    TEST_ROUNDTRIP("-4.9406564584124654e-324");
+    TEST_ROUNDTRIP("2.2250738585072009e-308");  /* Max subnormal double */
+    TEST_ROUNDTRIP("-2.2250738585072009e-308");
+    TEST_ROUNDTRIP("2.2250738585072014e-308");  /* Min normal positive double */
+    TEST_ROUNDTRIP("-2.2250738585072014e-308");
+    TEST_ROUNDTRIP("1.7976931348623157e+308");  /* Max double */
+    TEST_ROUNDTRIP("-1.7976931348623157e+308");
+}
+
+static void test_stringify_string()
+{
+    TEST_ROUNDTRIP("\"\"");
+    TEST_ROUNDTRIP("\"Hello\"");
+    TEST_ROUNDTRIP("\"Hello\\nWorld\"");
+    TEST_ROUNDTRIP("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
+    TEST_ROUNDTRIP("\"Hello\\u0000World\"");
+}
+
+static void test_stringify_array()
+{
+    TEST_ROUNDTRIP("[]");
+    TEST_ROUNDTRIP("[null,false,true,123,\"abc\",[1,2,3]]");
+}
+
+static void test_stringify_object()
+{
+    TEST_ROUNDTRIP("{}");
+    TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+}
+
+static void test_writer()
+{
+    // a tiny buffer forces many flushes to the sink
+    {
+        std::string out;
+        size_t calls = 0;
+        Json_callback_sink sink([&](const char *data, size_t len) {
+            calls++;
+            out.append(data, len);
+            return true;
+        });
+        {
+            Json_writer w(sink, 64);
+            w.start_array();
+            for (int i = 0; i < 100; ++i) {
+                w.start_object();
+                w.key("id");
+                w.number(i);
+                w.key("tag");
+                w.string("x\"y");
+                w.end_object();
+            }
+            EXPECT_TRUE(w.end_array());
+        }
+        EXPECT_TRUE(calls > 1);
+
+        Json js;
+        Json_value val;
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, out));
+        EXPECT_EQ_SIZE_T(100, val.arr.size);
+        EXPECT_EQ_DOUBLE(99.0, val.arr.elem[99].obj.mem[0].val.number);
+        EXPECT_EQ_STRING("x\"y", val.arr.elem[99].obj.mem[1].val.get_string(),
+                         val.arr.elem[99].obj.mem[1].val.get_string_length());
+    }
+
+    // pretty printing
+    {
+        std::string out;
+        Json_string_sink sink(out);
+        Json js;
+        Json_value val;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "{\"a\":[1,{}],\"b\":[]}"));
+        {
+            Json_writer w(sink, 4096, 2);
+            w.value(&val);
+        }
+        EXPECT_EQ_STRING("{\n  \"a\": [\n    1,\n    {}\n  ],\n  \"b\": []\n}",
+                         out.c_str(), out.size());
+    }
+
+#ifndef _WINDOWS
+    // a full iovec list fails the writer
+    {
+        char b1[4], b2[4];
+        struct iovec iov[2] = { { b1, sizeof(b1) }, { b2, sizeof(b2) } };
+        Json_iovec_sink sink(iov, 2);
+        Json_writer w(sink, 64);
+
+        w.start_array();
+        w.number(1);
+        w.number(2);
+        w.end_array();
+        EXPECT_TRUE(w.flush());
+        EXPECT_EQ_SIZE_T(5, sink.size());
+        EXPECT_TRUE(memcmp(b1, "[1,2", 4) == 0 && b2[0] == ']');
+
+        w.string("too long");
+        EXPECT_FALSE(w.flush());
+    }
+#endif
+}
+
 static void test_stringify()
 {
+    test_stringify_number();
+    test_stringify_string();
+    test_stringify_array();
+    test_stringify_object();
+    test_writer();
+}
+
+#define TEST_PATCH_ROUNDTRIP(from_str, to_str) \
+    do { \
+        Json js; \
+        Json_value from, to, patch, check; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&from, from_str)); \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&to, to_str)); \
+        make_patch(&patch, &from, &to); \
+        EXPECT_EQ_INT(Json_state::OK, apply_patch(&from, &patch)); \
+        make_patch(&check, &from, &to); \
+        EXPECT_EQ_SIZE_T(0, check.arr.size); \
+    } while (0)
+
+#define TEST_APPLY_PATCH(expect, state, doc_str, patch_str) \
+    do { \
+        Json js; \
+        Json_value doc, patch; \
+        std::string out; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&doc, doc_str)); \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&patch, patch_str)); \
+        EXPECT_EQ_INT(state, apply_patch(&doc, &patch)); \
+        js.stringify(out, &doc); \
+        EXPECT_EQ_STRING(expect, out.c_str(), out.size()); \
+    } while (0)
+
+#define TEST_MERGE_PATCH(expect, doc_str, patch_str) \
+    do { \
+        Json js; \
+        Json_value doc, patch; \
+        std::string out; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&doc, doc_str)); \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&patch, patch_str)); \
+        apply_merge_patch(&doc, &patch); \
+        js.stringify(out, &doc); \
+        EXPECT_EQ_STRING(expect, out.c_str(), out.size()); \
+    } while (0)
+
+static void test_patch()
+{
+    TEST_PATCH_ROUNDTRIP("null", "null");
+    TEST_PATCH_ROUNDTRIP("1", "\"x\"");
+    TEST_PATCH_ROUNDTRIP("[1,2,3]", "[1,2,3]");
+    TEST_PATCH_ROUNDTRIP("[1,2,3]", "[0,1,2,3]");
+    TEST_PATCH_ROUNDTRIP("[1,2,3]", "[1,3]");
+    TEST_PATCH_ROUNDTRIP("[1,2,3,4,5]", "[1,9,8,7,5]");
+    TEST_PATCH_ROUNDTRIP("[1,[2,{\"a\":1}],3]", "[1,[2,{\"a\":2,\"b\":[]}]]");
+    TEST_PATCH_ROUNDTRIP("{\"a\":1,\"b\":{\"c\":[1,2]},\"a/b\":0,\"m~n\":1}",
+                         "{\"b\":{\"c\":[2],\"d\":null},\"e\":true,\"a/b\":1}");
+    TEST_PATCH_ROUNDTRIP("{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9}",
+                         "{\"k9\":9,\"k8\":0,\"k7\":7,\"k6\":6,\"k5\":5,\"k4\":4,\"k3\":3,\"k2\":2,\"k1\":1,\"kx\":0}");
+
+    /* the examples of RFC 6902 appendix A */
+    TEST_APPLY_PATCH("{\"foo\":\"bar\",\"baz\":\"qux\"}", Json_state::OK,
+                     "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]");
+    TEST_APPLY_PATCH("{\"foo\":[\"bar\",\"qux\",\"baz\"]}", Json_state::OK,
+                     "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]");
+    TEST_APPLY_PATCH("{\"foo\":[\"bar\",\"baz\"]}", Json_state::OK,
+                     "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]");
+    TEST_APPLY_PATCH("{\"baz\":\"boo\",\"foo\":\"bar\"}", Json_state::OK,
+                     "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]");
+    TEST_APPLY_PATCH("{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}", Json_state::OK,
+                     "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+                     "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]");
+    TEST_APPLY_PATCH("{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", Json_state::OK,
+                     "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+                     "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]");
+    TEST_APPLY_PATCH("{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}", Json_state::OK,
+                     "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+                     "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},"
+                     "{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]");
+    TEST_APPLY_PATCH("{\"baz\":\"qux\"}", Json_state::PATCH_TEST_FAILED,
+                     "{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]");
+    TEST_APPLY_PATCH("{\"foo\":\"bar\"}", Json_state::PATCH_PATH_NOT_FOUND,
+                     "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]");
+    TEST_APPLY_PATCH("[1,2,[1,2]]", Json_state::OK,
+                     "[1,2]", "[{\"op\":\"copy\",\"from\":\"\",\"path\":\"/-\"}]");
+    TEST_APPLY_PATCH("{\"a\":{\"b\":1}}", Json_state::INVALID_PATCH,
+                     "{\"a\":{\"b\":1}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/c\"}]");
+    TEST_APPLY_PATCH("{\"a\":1}", Json_state::PATCH_PATH_NOT_FOUND,
+                     "{\"a\":1}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/b/c\"}]");
+    TEST_APPLY_PATCH("[1,[2],3]", Json_state::PATCH_PATH_NOT_FOUND,
+                     "[1,[2],3]", "[{\"op\":\"move\",\"from\":\"/1\",\"path\":\"/3\"}]");
+    TEST_APPLY_PATCH("[1]", Json_state::INVALID_PATCH, "[1]", "[{\"op\":\"jump\",\"path\":\"\"}]");
+    TEST_APPLY_PATCH("[1]", Json_state::INVALID_PATCH, "[1]", "[{\"op\":\"remove\",\"path\":\"0\"}]");
+    TEST_APPLY_PATCH("[1]", Json_state::PATCH_PATH_NOT_FOUND, "[1]", "[{\"op\":\"remove\",\"path\":\"/01\"}]");
+    TEST_APPLY_PATCH("{\"~\":2}", Json_state::OK, "{\"~\":1}",
+                     "[{\"op\":\"replace\",\"path\":\"/~0\",\"value\":2}]");
+
+    /* the examples of RFC 7386 appendix A */
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":\"b\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":\"b\"}", "{\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{}", "{\"a\":\"b\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":[\"b\"]}");
+    TEST_MERGE_PATCH("{\"a\":{\"b\":\"d\"}}", "{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}");
+    TEST_MERGE_PATCH("{\"a\":[1]}", "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}");
+    TEST_MERGE_PATCH("[\"c\",\"d\"]", "[\"a\",\"b\"]", "[\"c\",\"d\"]");
+    TEST_MERGE_PATCH("[\"c\"]", "{\"a\":\"b\"}", "[\"c\"]");
+    TEST_MERGE_PATCH("null", "{\"a\":\"foo\"}", "null");
+    TEST_MERGE_PATCH("{\"e\":null,\"a\":1}", "{\"e\":null}", "{\"a\":1}");
+    TEST_MERGE_PATCH("{\"a\":{\"bb\":{}}}", "{}", "{\"a\":{\"bb\":{\"ccc\":null}}}");
+
+    {
+        Json js;
+        Json_value from, to, patch;
+        std::string out;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&from,
+            "{\"a\":1,\"b\":{\"c\":1,\"d\":[1]},\"e\":\"x\"}"));
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&to,
+            "{\"a\":1,\"b\":{\"c\":2,\"d\":[1]},\"f\":true}"));
+        make_merge_patch(&patch, &from, &to);
+        js.stringify(out, &patch);
+        EXPECT_EQ_STRING("{\"e\":null,\"b\":{\"c\":2},\"f\":true}", out.c_str(), out.size());
+
+        apply_merge_patch(&from, &patch);
+        make_merge_patch(&patch, &from, &to);
+        EXPECT_EQ_SIZE_T(0, patch.obj.size);
+    }
+}
+
+#define TEST_CANONICAL(expect, jstr) \
+    do { \
+        Json js; \
+        Json_value val; \
+        std::string out; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, jstr)); \
+        EXPECT_EQ_INT(Json_state::OK, js.stringify_canonical(out, &val)); \
+        EXPECT_EQ_STRING(expect, out.c_str(), out.size()); \
+    } while (0)
+
+#define TEST_EQUAL(expect, jstr1, jstr2) \
+    do { \
+        Json js; \
+        Json_value v1, v2; \
+        uint64_t h1, h2; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&v1, jstr1, &h1)); \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&v2, jstr2, &h2)); \
+        EXPECT_EQ_INT(expect, v1.equals(&v2)); \
+        EXPECT_EQ_INT(expect, v2.equals(&v1)); \
+        EXPECT_EQ_INT(expect, h1 == h2); \
+        EXPECT_TRUE(h1 == v1.hash()); \
+        EXPECT_TRUE(h2 == v2.hash()); \
+    } while (0)
+
+static void test_equal()
+{
+    TEST_EQUAL(1, "true", "true");
+    TEST_EQUAL(0, "true", "false");
+    TEST_EQUAL(0, "false", "null");
+    TEST_EQUAL(1, "123", "123");
+    TEST_EQUAL(1, "0", "-0");
+    TEST_EQUAL(0, "123", "456");
+    TEST_EQUAL(1, "\"abc\"", "\"abc\"");
+    TEST_EQUAL(0, "\"abc\"", "\"abcd\"");
+    TEST_EQUAL(0, "\"0123456789abcdefX\"", "\"0123456789abcdefY\"");
+    TEST_EQUAL(1, "[]", "[]");
+    TEST_EQUAL(0, "[]", "null");
+    TEST_EQUAL(1, "[1,2,3]", "[1,2,3]");
+    TEST_EQUAL(0, "[1,2,3]", "[1,2,3,4]");
+    TEST_EQUAL(0, "[1,2]", "[2,1]");
+    TEST_EQUAL(1, "[[]]", "[[]]");
+    TEST_EQUAL(0, "[[]]", "[{}]");
+    TEST_EQUAL(1, "{}", "{}");
+    TEST_EQUAL(1, "{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":2}");
+    TEST_EQUAL(1, "{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":1}");
+    TEST_EQUAL(0, "{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":3}");
+    TEST_EQUAL(0, "{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":2,\"c\":3}");
+    TEST_EQUAL(0, "{\"a\":1,\"b\":2}", "{\"a\":2,\"b\":1}");
+    TEST_EQUAL(1, "{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":{}}}}");
+    TEST_EQUAL(0, "{\"a\":{\"b\":{\"c\":{}}}}", "{\"a\":{\"b\":{\"c\":[]}}}");
+    TEST_EQUAL(1, "[{\"x\":[1,\"s\"],\"y\":null},true]", "[{\"y\":null,\"x\":[1,\"s\"]},true]");
+
+    /* repeated keys compare as a multiset of members, as they hash */
+    TEST_EQUAL(0, "{\"a\":1,\"a\":1}", "{\"a\":1,\"b\":2}");
+    TEST_EQUAL(0, "{\"a\":1,\"a\":1}", "{\"a\":1,\"a\":2}");
+    TEST_EQUAL(1, "{\"a\":1,\"a\":2}", "{\"a\":2,\"a\":1}");
+    TEST_EQUAL(1, "{\"a\":1,\"b\":0,\"a\":2}", "{\"b\":0,\"a\":2,\"a\":1}");
+    TEST_EQUAL(0, "{\"c\":1,\"a\":1,\"a\":1}", "{\"a\":1,\"b\":1,\"c\":1}");
+    TEST_EQUAL(0, "{\"c\":1,\"a\":1,\"b\":1}", "{\"a\":1,\"a\":1,\"c\":1}");
+    TEST_EQUAL(1, "{\"k3\":[3],\"k1\":{\"x\":1,\"y\":2},\"k2\":null,\"k0\":\"s\"}",
+                  "{\"k0\":\"s\",\"k1\":{\"y\":2,\"x\":1},\"k2\":null,\"k3\":[3]}");
+}
+
+static void test_stringify_canonical()
+{
+    TEST_CANONICAL("0", "-0");
+    TEST_CANONICAL("1", "1.0");
+    TEST_CANONICAL("-1.5", "-1.5");
+    TEST_CANONICAL("1e+21", "1e21");
+    TEST_CANONICAL("123456789012345680000", "123456789012345678901");
+    TEST_CANONICAL("1e-7", "1e-7");
+    TEST_CANONICAL("0.000001", "1e-6");
+    TEST_CANONICAL("333333333.3333333", "333333333.33333329");
+    TEST_CANONICAL("5e-324", "4.9406564584124654e-324");
+    TEST_CANONICAL("1.7976931348623157e+308", "1.7976931348623157e308");
+    TEST_CANONICAL("9007199254740992", "9007199254740992");
+    TEST_CANONICAL("0.1", "0.1");
+
+    TEST_CANONICAL("\"\\u001f\\n\\\"\u007f\xE2\x82\xAC\"", "\"\\u001F\\n\\\"\\u007f\\u20ac\"");
+    TEST_CANONICAL("[null,true,{}]", " [ null , true , { } ] ");
+
+    /* RFC 8785 section 3.2.3 sorting example */
+    TEST_CANONICAL("{\"\\r\":\"Carriage Return\","
+                   "\"1\":\"One\","
+                   "\"\xC2\x80\":\"Control\","
+                   "\"\xC3\xB6\":\"Latin Small Letter O With Diaeresis\","
+                   "\"\xE2\x82\xAC\":\"Euro Sign\","
+                   "\"\xF0\x9F\x98\x80\":\"Emoji: Grinning Face\","
+                   "\"\xEF\xAC\xB3\":\"Hebrew Letter Dalet With Dagesh\"}",
+                   "{\"\\u20ac\": \"Euro Sign\", \"\\r\": \"Carriage Return\","
+                   " \"\\ufb33\": \"Hebrew Letter Dalet With Dagesh\", \"1\": \"One\","
+                   " \"\\ud83d\\ude00\": \"Emoji: Grinning Face\", \"\\u0080\": \"Control\","
+                   " \"\\u00f6\": \"Latin Small Letter O With Diaeresis\"}");
+    TEST_CANONICAL("{\"a\":{\"a\":1,\"b\":[]},\"ab\":0}", "{\"ab\":0,\"a\":{\"b\":[],\"a\":1}}");
+
+    /* non-finite numbers have no canonical form */
+    Json js;
+    Json_value val;
+    std::string out;
+    val.set_number(HUGE_VAL);
+    EXPECT_EQ_INT(Json_state::NUMBER_NOT_FINITE, js.stringify_canonical(out, &val));
+    EXPECT_EQ_SIZE_T(0, out.size());
+    val.set_number(-HUGE_VAL);
+    EXPECT_EQ_INT(Json_state::NUMBER_NOT_FINITE, js.stringify_canonical(out, &val));
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "{\"a\":[1,{\"b\":2}],\"c\":[3,4]}"));
+    val.find("a", 1)->arr.elem[1].find("b", 1)->set_number(std::nan(""));
+    EXPECT_EQ_INT(Json_state::NUMBER_NOT_FINITE, js.stringify_canonical(out, &val));
+    val.set_null();
+    js.set_pack_numbers(true);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[1,2]"));
+    val.narr.num[1] = std::nan("");
+    EXPECT_EQ_INT(Json_state::NUMBER_NOT_FINITE, js.stringify_canonical(out, &val));
+}
+
+static void test_pack_numbers()
+{
+    Json js;
+    js.set_pack_numbers(true);
+
+    {
+        Json_value val;
+        uint64_t h;
+        std::string out;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val,
+            "{\"p\":[1,-2.5,3e2],\"m\":[1,\"x\"],\"e\":[],\"n\":[[0],[1,2]]}", &h));
+        Json_value *p = val.find("p", 1), *m = val.find("m", 1);
+        Json_value *e = val.find("e", 1), *n = val.find("n", 1);
+
+        EXPECT_TRUE(p->is_packed());
+        EXPECT_EQ_SIZE_T(3, p->narr.size);
+        EXPECT_EQ_DOUBLE(-2.5, p->narr.num[1]);
+        EXPECT_EQ_DOUBLE(300.0, p->narr.num[2]);
+        EXPECT_FALSE(m->is_packed());
+        EXPECT_FALSE(e->is_packed());
+        EXPECT_FALSE(n->is_packed());
+        EXPECT_TRUE(n->arr.elem[1].is_packed());
+
+        /* packed and unpacked trees are interchangeable */
+        EXPECT_TRUE(h == val.hash());
+        Json js2;
+        Json_value plain;
+        uint64_t h2;
+        EXPECT_EQ_INT(Json_state::OK, js2.parse(&plain,
+            "{\"p\":[1,-2.5,3e2],\"m\":[1,\"x\"],\"e\":[],\"n\":[[0],[1,2]]}", &h2));
+        EXPECT_TRUE(h == h2);
+        EXPECT_TRUE(val.equals(&plain));
+        EXPECT_TRUE(plain.equals(&val));
+
+        js.stringify(out, &val);
+        EXPECT_EQ_STRING("{\"p\":[1,-2.5,300],\"m\":[1,\"x\"],\"e\":[],\"n\":[[0],[1,2]]}",
+                         out.c_str(), out.size());
+        js.stringify_canonical(out, &val);
+        EXPECT_EQ_STRING("{\"e\":[],\"m\":[1,\"x\"],\"n\":[[0],[1,2]],\"p\":[1,-2.5,300]}",
+                         out.c_str(), out.size());
+
+        Json_value copy;
+        copy.copy(&val);
+        EXPECT_TRUE(copy.find("p", 1)->is_packed());
+        EXPECT_TRUE(copy.equals(&val));
+
+        p->unpack();
+        EXPECT_FALSE(p->is_packed());
+        EXPECT_EQ_INT(Json_type::JSON_NUMBER, p->arr.elem[2].type);
+        EXPECT_EQ_DOUBLE(300.0, p->arr.elem[2].number);
+        EXPECT_TRUE(copy.equals(&val));
+    }
+
+    /* patches go through packed arrays */
+    {
+        Json_value from, to, patch, patch2, check;
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&from, "[[1,2,3],[4,5]]"));
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&to, "[[1,3],[4,5,6]]"));
+        make_patch(&patch, &from, &to);
+        EXPECT_EQ_INT(Json_state::OK, apply_patch(&from, &patch));
+        EXPECT_TRUE(from.equals(&to));
+
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&patch2,
+            "[{\"op\":\"remove\",\"path\":\"/1/0\"},{\"op\":\"add\",\"path\":\"/0/-\",\"value\":\"x\"}]"));
+        EXPECT_EQ_INT(Json_state::OK, apply_patch(&to, &patch2));
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&check, "[[1,3,\"x\"],[5,6]]"));
+        EXPECT_TRUE(to.equals(&check));
+    }
+
+    {
+        Json_value val;
+        double num[] = { 0.5, 1.5 };
+
+        val.set_packed(num, 2);
+        EXPECT_TRUE(val.is_packed());
+        EXPECT_EQ_SIZE_T(2, val.arr.size);
+        val.insert_element(2)->set_boolean(true);
+        EXPECT_FALSE(val.is_packed());
+        EXPECT_EQ_INT(Json_type::JSON_TRUE, val.arr.elem[2].type);
+        EXPECT_EQ_DOUBLE(1.5, val.arr.elem[1].number);
+    }
+
+    /* mutators grow their storage geometrically */
+    {
+        Json_malloc_allocator counted;
+        Json_allocator_scope scope(&counted);
+        Json_value val;
+        char key[8];
+
+        val.set_array();
+        for (int i = 0; i < 1000; ++i)
+            val.insert_element(i % 2 == 0 ? 0 : val.arr.size)->set_number(i);
+        EXPECT_EQ_SIZE_T(1000, val.arr.size);
+        EXPECT_EQ_DOUBLE(998.0, val.arr.elem[0].number);
+        EXPECT_EQ_DOUBLE(999.0, val.arr.elem[999].number);
+        EXPECT_TRUE(counted.stats().allocations <= 10);
+        for (int i = 0; i < 500; ++i)
+            val.erase_element(0);
+        EXPECT_EQ_DOUBLE(1.0, val.arr.elem[0].number);
+
+        Json_value obj;
+        obj.set_object();
+        for (int i = 0; i < 100; ++i)
+            obj.set_member(key, snprintf(key, sizeof(key), "k%d", i))->set_number(i);
+        EXPECT_TRUE(obj.erase_member("k0", 2));
+        EXPECT_TRUE(obj.erase_member("k50", 3));
+        EXPECT_EQ_SIZE_T(98, obj.obj.size);
+        EXPECT_EQ_DOUBLE(99.0, obj.find("k99", 3)->number);
+        EXPECT_TRUE(obj.find("k50", 3) == nullptr);
+        EXPECT_TRUE(counted.stats().allocations <= 20);
+    }
+}
+
+static void test_document()
+{
+    Json js;
+    Json_value patch, expect;
+    Json_state state;
+
+    EXPECT_TRUE(Json_document::parse(js, "{\"a\":", &state) == nullptr);
+    EXPECT_EQ_INT(Json_state::EXPECT_VALUE, state);
+
+    Json_document_ptr v1 = Json_document::parse(js,
+        "{\"server\":{\"host\":\"db.internal.example.com\",\"port\":8080},"
+        "\"limits\":[1,2,3],\"name\":\"a rather long service name\"}");
+    EXPECT_TRUE(v1 != nullptr);
+
+    /* subtree handles keep the document alive */
+    Json_node_ptr limits = v1->retain(v1->root()->find("limits", 6));
+    const Json_value *server = v1->root()->find("server", 6);
+
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&patch,
+        "{\"server\":{\"port\":9090,\"tls\":true},\"name\":null,\"new\":{\"x\":null,\"y\":1}}"));
+    Json_document_ptr v2 = v1->derive(&patch);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&expect,
+        "{\"server\":{\"host\":\"db.internal.example.com\",\"port\":9090,\"tls\":true},"
+        "\"limits\":[1,2,3],\"new\":{\"y\":1}}"));
+    EXPECT_TRUE(v2->root()->equals(&expect));
+
+    /* untouched values are shared, the base is unchanged */
+    const Json_value *limits2 = v2->root()->find("limits", 6);
+    EXPECT_TRUE(limits2->arr.elem == limits->arr.elem);
+    EXPECT_TRUE(limits2->flags & JSON_BORROWED);
+    EXPECT_TRUE(v2->root()->find("server", 6)->find("host", 4)->get_string() ==
+                server->find("host", 4)->get_string());
+    EXPECT_EQ_DOUBLE(8080.0, server->find("port", 4)->number);
+    EXPECT_TRUE(v1->root()->find("name", 4) != nullptr);
+
+    /* derived versions outlive their base */
+    Json_node_ptr host = v2->retain(v2->root()->find("server", 6)->find("host", 4));
+    v1.reset();
+    EXPECT_EQ_STRING("db.internal.example.com", host->get_string(), host->get_string_length());
+    EXPECT_EQ_SIZE_T(3, limits->arr.size);
+    limits.reset();
+
+    Json_document_ptr flat = v2->flatten();
+    EXPECT_TRUE(flat->root()->equals(v2->root()));
+    EXPECT_FALSE(flat->root()->find("limits", 6)->flags & JSON_BORROWED);
+
+    /* hot reload: readers keep the version they loaded */
+    Json_document_slot slot(v2);
+    v2.reset();
+    Json_document_ptr seen = slot.load();
+    Json_value p2;
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&p2, "{\"server\":{\"port\":1}}"));
+    Json_document_ptr v3 = slot.update(&p2);
+    EXPECT_TRUE(slot.load() == v3);
+    EXPECT_EQ_DOUBLE(1.0, v3->root()->find("server", 6)->find("port", 4)->number);
+    EXPECT_EQ_DOUBLE(9090.0, seen->root()->find("server", 6)->find("port", 4)->number);
+    seen.reset();
+    EXPECT_EQ_STRING("db.internal.example.com", host->get_string(), host->get_string_length());
+
+    slot.store(flat);
+    EXPECT_TRUE(slot.load()->root()->equals(&expect));
+
+    Json_document_slot empty;
+    EXPECT_TRUE(empty.update(&p2)->root()->equals(&p2));
+
+    /* long runs of updates do not keep every past version alive */
+    std::weak_ptr<const Json_document> first = flat;
+    flat.reset();
+    for (int i = 0; i < 100; ++i) {
+        Json_value port;
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&port,
+            "{\"server\":{\"port\":" + std::to_string(i) + "}}"));
+        slot.update(&port);
+    }
+    EXPECT_TRUE(first.expired());
+    EXPECT_EQ_DOUBLE(99.0, slot.load()->root()->find("server", 6)->find("port", 4)->number);
+}
+
+static FILE* make_stream(const std::string &data)
+{
+    FILE *f = tmpfile();
+    fwrite(data.data(), 1, data.size(), f);
+    rewind(f);
+    return f;
+}
+
+#ifdef JSONPARSER_HAVE_ZLIB
+static std::string gzip(const std::string &text)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, text.size()), '\0');
+    zs.next_in = (Bytef*)text.data();
+    zs.avail_in = (uInt)text.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = (uInt)out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+#endif
 
+/* reads every value of data, chunk_size bytes at a time, restringified */
+static Json_state read_stream(const std::string &data, size_t chunk_size,
+                              std::vector<std::string> &values)
+{
+    Json js;
+    Json_value val;
+    FILE *f = make_stream(data);
+    Json_state state;
+    values.clear();
+    {
+        Json_stream_reader reader(js, f, JSON_COMPRESSION_AUTO, chunk_size, 2);
+        while (true) {
+            bool ok = reader.next(&val);
+            if (!ok && (reader.state() == Json_state::OK ||
+                        reader.state() == Json_state::DECOMPRESSION_ERROR))
+                break;
+            std::string out;
+            if (ok)
+                js.stringify(out, &val);
+            else
+                out = "error";
+            values.push_back(out);
+            val.set_null();
+        }
+        state = reader.state();
+    }
+    fclose(f);
+    return state;
+}
+
+static void test_stream()
+{
+    std::vector<std::string> values;
+    const std::string ndjson =
+        "{\"a\":[1,2,{\"b\":\"}]\\\"\"}]}\n"
+        "  \"x y\" 12 true[] \n"
+        "{}{\"c\":null}\r\n-5";
+
+    for (size_t chunk = 1; chunk <= 64; chunk *= 4) {
+        EXPECT_EQ_INT(Json_state::OK, read_stream(ndjson, chunk, values));
+        EXPECT_EQ_SIZE_T(8, values.size());
+        if (values.size() == 8) {
+            EXPECT_EQ_STRING("{\"a\":[1,2,{\"b\":\"}]\\\"\"}]}",
+                             values[0].c_str(), values[0].size());
+            EXPECT_EQ_STRING("\"x y\"", values[1].c_str(), values[1].size());
+            EXPECT_EQ_STRING("12", values[2].c_str(), values[2].size());
+            EXPECT_EQ_STRING("true", values[3].c_str(), values[3].size());
+            EXPECT_EQ_STRING("[]", values[4].c_str(), values[4].size());
+            EXPECT_EQ_STRING("{}", values[5].c_str(), values[5].size());
+            EXPECT_EQ_STRING("{\"c\":null}", values[6].c_str(), values[6].size());
+            EXPECT_EQ_STRING("-5", values[7].c_str(), values[7].size());
+        }
+    }
+
+    /* a bad value is reported and skipped */
+    EXPECT_EQ_INT(Json_state::OK, read_stream("[1,]\n[2]\n", 3, values));
+    EXPECT_EQ_SIZE_T(2, values.size());
+    if (values.size() == 2) {
+        EXPECT_EQ_STRING("error", values[0].c_str(), values[0].size());
+        EXPECT_EQ_STRING("[2]", values[1].c_str(), values[1].size());
+    }
+    EXPECT_EQ_INT(Json_state::OK, read_stream(" \n ", 16, values));
+    EXPECT_EQ_SIZE_T(0, values.size());
+
+#ifdef JSONPARSER_HAVE_ZLIB
+    /* concatenated gzip members decompress as one stream */
+    std::string big = "[";
+    for (int i = 0; i < 10000; ++i)
+        big += "\"0123456789\",";
+    big += "0]";
+    std::string gz = gzip(ndjson + "\n") + gzip(big);
+    EXPECT_EQ_INT(Json_state::OK, read_stream(gz, 4096, values));
+    EXPECT_EQ_SIZE_T(9, values.size());
+    if (values.size() == 9)
+        EXPECT_TRUE(values[8] == big);
+
+    gz.resize(gz.size() - 10);
+    EXPECT_EQ_INT(Json_state::DECOMPRESSION_ERROR, read_stream(gz, 4096, values));
+    EXPECT_EQ_SIZE_T(8, values.size());
+#endif
+#ifndef JSONPARSER_HAVE_ZSTD
+    EXPECT_EQ_INT(Json_state::DECOMPRESSION_ERROR,
+                  read_stream("\x28\xB5\x2F\xFD", 16, values));
+#endif
+}
+
+#define TEST_SCHEMA(expect, expect_path, schema, jstr) \
+    do { \
+        Json js; \
+        Json_value v; \
+        std::string path; \
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&v, jstr)); \
+        EXPECT_EQ_INT(expect, schema.validate(&v, &path)); \
+        EXPECT_EQ_STRING(expect_path, path.c_str(), path.size()); \
+        v.set_null(); \
+        js.set_schema(&schema); \
+        EXPECT_EQ_INT(expect, js.parse(&v, jstr)); \
+        EXPECT_EQ_STRING(expect_path, js.schema_path().c_str(), js.schema_path().size()); \
+    } while (0)
+
+static void test_schema_compile(Json_state expect, const char *jstr)
+{
+    Json js;
+    Json_value v;
+    Json_schema schema;
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&v, jstr));
+    EXPECT_EQ_INT(expect, schema.compile(&v));
+}
+
+static void test_schema()
+{
+    test_schema_compile(Json_state::OK, "true");
+    test_schema_compile(Json_state::OK, "{}");
+    test_schema_compile(Json_state::OK,
+        "{\"$schema\":\"https://json-schema.org/draft/2020-12/schema\","
+        "\"title\":\"t\",\"type\":[\"string\",\"null\"],\"maxLength\":3}");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "1");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "{\"type\":\"text\"}");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "{\"minimum\":\"1\"}");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "{\"minLength\":-1}");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "{\"required\":[1]}");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "{\"pattern\":\"(\"}");
+    test_schema_compile(Json_state::INVALID_SCHEMA, "{\"items\":{\"$ref\":\"#\"}}");
+
+    Json js;
+    Json_value sv;
+    Json_schema schema;
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&sv,
+        "{\"type\":\"object\",\"required\":[\"id\",\"items\"],"
+        " \"properties\":{"
+        "  \"id\":{\"type\":\"integer\",\"minimum\":1},"
+        "  \"kind\":{\"enum\":[\"a\",\"b\",[1,2]]},"
+        "  \"tags\":{\"type\":\"array\",\"maxItems\":2,"
+        "            \"items\":{\"type\":\"string\",\"pattern\":\"^[a-z]+$\"}},"
+        "  \"scores\":{\"items\":{\"exclusiveMaximum\":10}},"
+        "  \"items\":{\"type\":\"array\",\"items\":{"
+        "    \"type\":\"object\",\"required\":[\"name\"],"
+        "    \"properties\":{\"name\":{\"type\":\"string\",\"minLength\":2,\"maxLength\":3}}}}}}"));
+    EXPECT_EQ_INT(Json_state::OK, schema.compile(&sv));
+
+    TEST_SCHEMA(Json_state::OK, "", schema,
+        "{\"id\":1,\"items\":[],\"other\":{\"anything\":[null]}}");
+    TEST_SCHEMA(Json_state::OK, "", schema,
+        "{\"id\":2.0,\"kind\":[1,2],\"tags\":[\"x\",\"yz\"],\"scores\":[1,9.5],"
+        "\"items\":[{\"name\":\"\\u00e9\\u00e9\\u00e9\"}]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "", schema, "[]");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "", schema, "{\"id\":1}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/id", schema, "{\"id\":1.5,\"items\":[]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/id", schema, "{\"id\":0,\"items\":[]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/kind", schema,
+        "{\"id\":1,\"items\":[],\"kind\":\"c\"}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/tags", schema,
+        "{\"id\":1,\"items\":[],\"tags\":[\"a\",\"b\",\"c\"]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/tags/1", schema,
+        "{\"id\":1,\"items\":[],\"tags\":[\"a\",\"B\"]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/scores/2", schema,
+        "{\"id\":1,\"items\":[],\"scores\":[1,2,10]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/items/1/name", schema,
+        "{\"id\":1,\"items\":[{\"name\":\"ab\"},{\"name\":\"abcd\"}]}");
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/items/0", schema,
+        "{\"id\":1,\"items\":[{\"nom\":\"ab\"}]}");
+
+    /* reference tokens are escaped */
+    Json_value sv2;
+    Json_schema schema2;
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&sv2,
+        "{\"properties\":{\"a/b~c\":{\"const\":null}}}"));
+    EXPECT_EQ_INT(Json_state::OK, schema2.compile(&sv2));
+    TEST_SCHEMA(Json_state::SCHEMA_MISMATCH, "/a~1b~0c", schema2, "{\"a/b~c\":0}");
+
+    /* fused validation stops at the first offending value and works
+       with packed numbers */
+    Json_value v;
+    js.set_schema(&schema);
+    js.set_pack_numbers(true);
+    EXPECT_EQ_INT(Json_state::SCHEMA_MISMATCH,
+                  js.parse(&v, "{\"id\":\"x\",\"items\":[1,]}"));
+    EXPECT_EQ_STRING("/id", js.schema_path().c_str(), js.schema_path().size());
+    EXPECT_EQ_INT(Json_state::OK,
+                  js.parse(&v, "{\"id\":3,\"items\":[],\"scores\":[1,2,3]}"));
+    EXPECT_TRUE(v.find("scores", 6)->flags & JSON_PACKED_NUMBERS);
+    EXPECT_EQ_INT(Json_state::OK, schema.validate(&v));
+    v.set_null();
+    EXPECT_EQ_INT(Json_state::SCHEMA_MISMATCH,
+                  js.parse(&v, "{\"id\":3,\"items\":[],\"scores\":[1,2,30]}"));
+    js.set_schema(nullptr);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&v, "{\"id\":\"x\"}"));
+    EXPECT_EQ_INT(0, (int)js.schema_path().size());
+}
+
+static void test_columns()
+{
+    Json js;
+    std::vector<Json_column> cols;
+    cols.push_back(Json_column("id", JSON_COLUMN_INT64));
+    cols.push_back(Json_column("price", JSON_COLUMN_DOUBLE));
+    cols.push_back(Json_column("name", JSON_COLUMN_STRING));
+
+    EXPECT_EQ_INT(Json_state::OK, js.parse_columns(
+        " [ {\"id\":9007199254740993,\"price\":1.5,\"name\":\"a\\u00e9\",\"x\":[{}]},"
+        "   {\"name\":null,\"id\":-2,\"price\":2,\"id\":7},"
+        "   {},"
+        "   {\"price\":1e2,\"id\":3.0e1,\"name\":\"\"} ] ", cols));
+    const Json_column &id = cols[0], &price = cols[1], &name = cols[2];
+    EXPECT_EQ_SIZE_T(4, id.size);
+    EXPECT_EQ_SIZE_T(4, price.size);
+    EXPECT_EQ_SIZE_T(4, name.size);
+    if (id.size == 4 && price.size == 4 && name.size == 4) {
+        EXPECT_TRUE(id.i64[0] == 9007199254740993LL);
+        EXPECT_TRUE(id.i64[1] == -2);
+        EXPECT_TRUE(id.i64[3] == 30);
+        EXPECT_TRUE(id.is_valid(0) && id.is_valid(1) && !id.is_valid(2) && id.is_valid(3));
+        EXPECT_EQ_SIZE_T(1, id.null_count);
+
+        EXPECT_EQ_DOUBLE(1.5, price.f64[0]);
+        EXPECT_EQ_DOUBLE(2.0, price.f64[1]);
+        EXPECT_EQ_DOUBLE(0.0, price.f64[2]);
+        EXPECT_EQ_DOUBLE(100.0, price.f64[3]);
+
+        EXPECT_EQ_SIZE_T(5, name.offsets.size());
+        EXPECT_EQ_STRING("a\xC3\xA9", name.bytes.data(), name.bytes.size());
+        EXPECT_TRUE(name.offsets[1] == 3 && name.offsets[2] == 3 &&
+                    name.offsets[3] == 3 && name.offsets[4] == 3);
+        EXPECT_TRUE(name.is_valid(0) && !name.is_valid(1) && !name.is_valid(2) &&
+                    name.is_valid(3));
+        EXPECT_EQ_SIZE_T(2, name.null_count);
+    }
+
+    /* rows accumulate past a bitmap byte, columns are cleared per call */
+    std::string many = "[";
+    for (int i = 0; i < 20; ++i)
+        many += i % 3 ? "{\"id\":1}," : "{\"id\":null},";
+    many += "{}]";
+    EXPECT_EQ_INT(Json_state::OK, js.parse_columns(many, cols));
+    EXPECT_EQ_SIZE_T(21, id.size);
+    EXPECT_EQ_SIZE_T(8, id.null_count);
+    EXPECT_EQ_SIZE_T(3, id.valid.size());
+    EXPECT_EQ_SIZE_T(21, name.null_count);
+    EXPECT_EQ_INT(Json_state::OK, js.parse_columns("[]", cols));
+    EXPECT_EQ_SIZE_T(0, id.size);
+    EXPECT_EQ_SIZE_T(1, name.offsets.size());
+
+    EXPECT_EQ_INT(Json_state::COLUMN_MISMATCH, js.parse_columns("{}", cols));
+    EXPECT_EQ_INT(Json_state::COLUMN_MISMATCH, js.parse_columns("[{},1]", cols));
+    EXPECT_EQ_INT(Json_state::COLUMN_MISMATCH, js.parse_columns("[{\"id\":1.5}]", cols));
+    EXPECT_EQ_INT(Json_state::COLUMN_MISMATCH,
+                  js.parse_columns("[{\"id\":9223372036854775808}]", cols));
+    EXPECT_EQ_INT(Json_state::COLUMN_MISMATCH, js.parse_columns("[{\"price\":\"1\"}]", cols));
+    EXPECT_EQ_INT(Json_state::COLUMN_MISMATCH, js.parse_columns("[{\"name\":true}]", cols));
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_columns("[{\"x\":nul}]", cols));
+
+    /* malformed tokens are parse errors whatever the column */
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_columns("[{\"name\":x}]", cols));
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_columns("[{\"name\":tru}]", cols));
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_columns("[{\"id\":x}]", cols));
+    EXPECT_EQ_INT(Json_state::MISS_COMMA_OR_SQUARE_BRACKET,
+                  js.parse_columns("[{\"id\":[1 2]}]", cols));
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_columns("[{},x]", cols));
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_columns("x", cols));
+    EXPECT_EQ_INT(Json_state::MISS_COMMA_OR_CURLY_BRACKET,
+                  js.parse_columns("[{\"id\":1]", cols));
+    EXPECT_EQ_INT(Json_state::MISS_COMMA_OR_SQUARE_BRACKET, js.parse_columns("[{}", cols));
+    EXPECT_EQ_INT(Json_state::ROOT_NOT_SINGULAR, js.parse_columns("[] 1", cols));
+
+    Json_limits limits;
+    limits.max_depth = 3;
+    js.set_limits(limits);
+    EXPECT_EQ_INT(Json_state::OK, js.parse_columns("[{\"x\":[]}]", cols));
+    EXPECT_EQ_INT(Json_state::DEPTH_LIMIT_EXCEEDED, js.parse_columns("[{\"x\":[[]]}]", cols));
+}
+
+static void write_file(const char *path, const std::string &text)
+{
+    FILE *fp = fopen(path, "wb");
+    fwrite(text.data(), 1, text.size(), fp);
+    fclose(fp);
+}
+
+static void test_store()
+{
+    const char *json_path = "test_store.json", *store_path = "test_store.bin";
+    const std::string text =
+        " {\"name\":\"a string long enough not to be inline\",\"n\":-1.25e3,"
+        "  \"list\":[true,false,null,[],{},[[1],\"\\u00e9\"]],"
+        "  \"nested\":{\"k\":{\"deep\":[1,2,3]}},\"n\":2,\"\":\"\"} ";
+
+    Json js;
+    Json_store store;
+    Json_value expect, val;
+
+    write_file(json_path, text);
+    EXPECT_EQ_INT(Json_state::OK, js.parse_store(json_path, store_path));
+    EXPECT_TRUE(store.open(store_path));
+
+    Json_store_value root = store.root();
+    EXPECT_EQ_INT(Json_type::JSON_OBJECT, root.type());
+    EXPECT_EQ_SIZE_T(6, root.size());
+    EXPECT_EQ_DOUBLE(-1250.0, root.find("n", 1).number());
+    EXPECT_EQ_STRING("list", root.get_key(2), root.get_key_length(2));
+    Json_store_value list = root.member(2);
+    EXPECT_EQ_SIZE_T(6, list.size());
+    EXPECT_EQ_INT(Json_type::JSON_TRUE, list.element(0).type());
+    EXPECT_EQ_INT(Json_type::JSON_NULL, list.element(2).type());
+    EXPECT_EQ_SIZE_T(0, list.element(3).size());
+    EXPECT_EQ_STRING("\xC3\xA9", list.element(5).element(1).get_string(),
+                     list.element(5).element(1).get_string_length());
+    Json_store_value deep = root.find("nested", 6).find("k", 1).find("deep", 4);
+    EXPECT_TRUE(deep.exists());
+    EXPECT_EQ_DOUBLE(3.0, deep.element(2).number());
+    EXPECT_FALSE(root.find("missing", 7).exists());
+    EXPECT_FALSE(list.find("n", 1).exists());
+
+    /* the same tree as parse() builds, repeated keys included */
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&expect, text));
+    root.copy_to(&val);
+    EXPECT_TRUE(val.equals(&expect));
+    EXPECT_EQ_SIZE_T(6, val.obj.size);
+    val.set_null();
+    store.close();
+
+    /* a text filling its last page exactly, and a wide array */
+    std::string wide = " [";
+    for (int i = 0; wide.size() < 8190; ++i)
+        wide += std::to_string(i % 10) + ",";
+    wide += "0]";
+    EXPECT_EQ_SIZE_T(8192, wide.size());
+    write_file(json_path, wide);
+    EXPECT_EQ_INT(Json_state::OK, js.parse_store(json_path, store_path));
+    EXPECT_TRUE(store.open(store_path));
+    EXPECT_EQ_SIZE_T(4095, store.root().size());
+    store.close();
+
+    /* failures leave no store behind */
+    write_file(json_path, "[1,{\"a\":[}]");
+    EXPECT_EQ_INT(Json_state::INVALID_VALUE, js.parse_store(json_path, store_path));
+    EXPECT_FALSE(store.open(store_path));
+    write_file(json_path, "");
+    EXPECT_EQ_INT(Json_state::EXPECT_VALUE, js.parse_store(json_path, store_path));
+    write_file(json_path, "{} x");
+    EXPECT_EQ_INT(Json_state::ROOT_NOT_SINGULAR, js.parse_store(json_path, store_path));
+    EXPECT_EQ_INT(Json_state::IO_ERROR, js.parse_store("no/such/file.json", store_path));
+    EXPECT_FALSE(store.open(json_path));
+
+    /* a file named like the spill file is left alone */
+    const std::string stack_path = std::string(store_path) + ".stack";
+    char kept[8] = { 0 };
+    write_file(stack_path.c_str(), "keep");
+    write_file(json_path, "[[1],[2]]");
+    EXPECT_EQ_INT(Json_state::OK, js.parse_store(json_path, store_path));
+    FILE *fp = fopen(stack_path.c_str(), "rb");
+    EXPECT_TRUE(fp != nullptr);
+    if (fp != nullptr) {
+        EXPECT_EQ_SIZE_T(4, fread(kept, 1, sizeof(kept), fp));
+        fclose(fp);
+    }
+    EXPECT_EQ_STRING("keep", kept, strlen(kept));
+
+    remove(stack_path.c_str());
+    remove(json_path);
+    remove(store_path);
+}
+
+// malloc until budget allocations were made, then std::bad_alloc
+class Throwing_allocator : public Json_allocator
+{
+public:
+    explicit Throwing_allocator(int budget) : budget_(budget) {}
+
+    void* allocate(size_t bytes) override
+    {
+        if (budget_-- <= 0)
+            throw std::bad_alloc();
+        counters_.allocated(bytes);
+        return malloc(bytes);
+    }
+    void deallocate(void *p, size_t bytes) override
+    {
+        counters_.deallocated(bytes);
+        free(p);
+    }
+    Json_allocator_stats stats() const override { return counters_.get(); }
+
+private:
+    int budget_;
+    Json_allocator_counters counters_;
+};
+
+static void test_allocator()
+{
+    const std::string text =
+        "{\"a key too long to be stored inline\":[1,2,3],"
+        " \"list\":[\"a string too long to be stored inline\",{\"x\":null},[[]]],"
+        " \"short\":\"s\"}";
+    Json js;
+    Json_value expect, val, copy;
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&expect, text));
+
+    /* parse, copy and mutate with a pool, all blocks come back */
+    {
+        Json_pool_allocator pool;
+        js.set_allocator(&pool);
+        js.set_pack_numbers(true);
+        EXPECT_EQ_INT(Json_state::OK, js.parse(&val, text));
+        EXPECT_TRUE(val.equals(&expect));
+        EXPECT_TRUE(val.flags & JSON_ALLOCATED);
+        EXPECT_TRUE(val.obj.mem[0].kflags & JSON_KEY_ALLOCATED);
+        EXPECT_TRUE(val.obj.mem[0].val.flags & JSON_ALLOCATED);
+        EXPECT_FALSE(val.obj.mem[2].val.flags & JSON_ALLOCATED);
+        Json_allocator_stats stats = pool.stats();
+        EXPECT_EQ_SIZE_T(7, stats.allocations);
+        EXPECT_EQ_SIZE_T(0, stats.deallocations);
+
+        {
+            Json_allocator_scope scope(&pool);
+            EXPECT_TRUE(Json_allocator::current() == &pool);
+            copy.copy(&val);
+            val.find("list", 4)->insert_element(0)->set_string(
+                "another string too long to be inline", 36);
+            val.set_member("added", 5)->set_array(2);
+        }
+        EXPECT_TRUE(Json_allocator::current() == nullptr);
+        EXPECT_TRUE(copy.equals(&expect));
+
+        /* blocks from malloc and the pool mixed in one tree */
+        val.find("list", 4)->erase_element(1);
+        val.set_member("plain", 5)->set_string("a string from malloc, not the pool", 34);
+        EXPECT_FALSE(val.flags & JSON_ALLOCATED);
+        val.erase_member("a key too long to be stored inline", 34);
+
+        stats = pool.stats();
+        EXPECT_TRUE(stats.allocations > 7);
+        EXPECT_TRUE(stats.peak_bytes >= stats.bytes_in_use);
+        val.set_null();
+        copy.set_null();
+        stats = pool.stats();
+        EXPECT_EQ_SIZE_T(stats.allocations, stats.deallocations);
+        EXPECT_EQ_SIZE_T(0, stats.bytes_in_use);
+        js.set_allocator(nullptr);
+    }
+
+    /* trees outlive the thread that built them in its pool */
+    Json_pool_allocator *pool = nullptr;
+    std::thread worker([&] {
+        Json wjs;
+        pool = &Json_pool_allocator::local();
+        wjs.set_allocator(pool);
+        wjs.parse(&val, text);
+    });
+    worker.join();
+    EXPECT_TRUE(val.equals(&expect));
+    val.set_null();
+    Json_allocator_stats stats = pool->stats();
+    EXPECT_EQ_SIZE_T(7, stats.allocations);
+    EXPECT_EQ_SIZE_T(7, stats.deallocations);
+    EXPECT_EQ_SIZE_T(0, stats.bytes_in_use);
+
+    Json_malloc_allocator counted;
+    js.set_allocator(&counted);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, text));
+    EXPECT_EQ_SIZE_T(7, counted.stats().allocations);
+    val.set_null();
+    EXPECT_EQ_SIZE_T(7, counted.stats().deallocations);
+    EXPECT_EQ_SIZE_T(0, counted.stats().bytes_in_use);
+    EXPECT_TRUE(counted.stats().peak_bytes > 0);
+
+#ifdef JSONPARSER_HAVE_PMR
+    std::pmr::monotonic_buffer_resource arena;
+    Json_pmr_allocator pmr(&arena);
+    js.set_allocator(&pmr);
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, text));
+    EXPECT_TRUE(val.equals(&expect));
+    val.set_null();
+    EXPECT_EQ_SIZE_T(pmr.stats().allocations, pmr.stats().deallocations);
+#endif
+    js.set_allocator(nullptr);
+
+    /* an allocator giving out fails the parse, the Json stays usable */
+    std::string big = "[";
+    for (int i = 0; i < 200; ++i)
+        big += "[\"a string too long to be stored inline\",{\"k\":[1,2,3]}],";
+    big += "0]";
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, "[1,2]"));
+    val.set_null();
+    for (int round = 0; round < 2; ++round) {
+        Throwing_allocator throwing(300);
+        js.set_allocator(&throwing);
+        EXPECT_EQ_INT(Json_state::OUT_OF_MEMORY, js.parse(&val, big));
+        EXPECT_EQ_INT(Json_type::JSON_NULL, val.type);
+        EXPECT_EQ_SIZE_T(0, throwing.stats().bytes_in_use);
+        js.set_allocator(nullptr);
+    }
+    EXPECT_EQ_INT(Json_state::OK, js.parse(&val, big));
+    EXPECT_EQ_SIZE_T(201, val.arr.size);
+    val.set_null();
 }
 
 int main(int argc, char **argv)
@@ -491,6 +1905,18 @@ int main(int argc, char **argv)
 #endif
     test_parse();
     test_stringify();
+    test_patch();
+    test_equal();
+    test_stringify_canonical();
+    test_pack_numbers();
+    test_document();
+    test_stream();
+    test_schema();
+    test_columns();
+#ifndef _WINDOWS
+    test_store();
+#endif
+    test_allocator();
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;
 }
\ No newline at end of file